@@ -0,0 +1,74 @@
+#include "resources.h"
+
+AsyncWriter::AsyncWriter(size_t capacity)
+    : capacity(max<size_t>(1, capacity)), busy(false), stopping(false), stalls(0), worker(&AsyncWriter::run, this) {}
+
+/**
+ * @brief Writes the queued jobs, then stops the thread.
+ */
+AsyncWriter::~AsyncWriter() {
+    flush();
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_ready.notify_all();
+    worker.join();
+}
+
+/**
+ * @brief Queues a job, waiting for a free slot if the queue is full.
+ *
+ * @param job Writes the output, it must own (or share read-only) everything it uses.
+ */
+void AsyncWriter::submit(function<void()> job) {
+    unique_lock<std::mutex> lock(mutex);
+    if (jobs.size() >= capacity) {
+        stalls.fetch_add(1, memory_order_relaxed);
+        slot_free.wait(lock, [&]() { return jobs.size() < capacity; });
+    }
+    jobs.push_back(std::move(job));
+    lock.unlock();
+    job_ready.notify_one();
+}
+
+/**
+ * @brief Waits until every job submitted so far is written.
+ */
+void AsyncWriter::flush() {
+    unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [&]() { return jobs.empty() && !busy; });
+}
+
+void AsyncWriter::run() {
+    unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        job_ready.wait(lock, [&]() { return !jobs.empty() || stopping; });
+        if (jobs.empty()) {
+            return;
+        }
+        function<void()> job = std::move(jobs.front());
+        jobs.pop_front();
+        busy = true;
+        lock.unlock();
+        slot_free.notify_one();
+        try {
+            job();
+        } catch (const exception& e) {
+            cerr << "Error writing output: " << e.what() << endl;
+        }
+        lock.lock();
+        busy = false;
+        if (jobs.empty()) {
+            all_done.notify_all();
+        }
+    }
+}
+
+/**
+ * @brief Returns the writer of the output files, flushed when the program exits.
+ */
+AsyncWriter& output_writer() {
+    static AsyncWriter writer;
+    return writer;
+}
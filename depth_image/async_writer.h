@@ -0,0 +1,53 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Jobs that can wait in the queue of the output writer
+#define ASYNC_WRITER_CAPACITY 8
+
+/**
+ * @brief Background thread writing output files in submission order.
+ *
+ * Each job owns the data it writes (copies or shared buffers nobody modifies any more), so
+ * the submitting thread can go on as soon as the job is queued. submit() blocks while the
+ * queue is full, so a slow disk slows the capture down instead of piling up memory. The
+ * destructor writes every queued job before returning.
+ */
+class AsyncWriter {
+public:
+    explicit AsyncWriter(std::size_t capacity = ASYNC_WRITER_CAPACITY);
+    ~AsyncWriter();
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    void submit(std::function<void()> job);
+    void flush();
+    // Number of times submit() had to wait for a free slot
+    uint64_t get_stalls() const { return stalls.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+
+    std::size_t capacity;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable slot_free;
+    std::condition_variable all_done;
+    bool busy;
+    bool stopping;
+    std::atomic<uint64_t> stalls;
+    std::thread worker;
+};
+
+AsyncWriter& output_writer();
+
+#endif // ASYNC_WRITER_H
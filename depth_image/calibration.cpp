@@ -8,8 +8,8 @@
 
 // Main function
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        printf("Usage: %s <maximum distance(m)> <number of frames to average> <dist to calculate mm>\n", argv[0]);
+    if (argc < 4) {
+        printf("Usage: %s <maximum distance(m)> <number of frames to average> <dist to calculate mm> [--source=<file.bag|raw Z16 dump>] [--workers=<n>] [--ring=<frames>] [--estimator=<mean|median|trimmed|mode>] [--adaptive=<stderr(mm)>[,<fraction>]] [--min-frames=<n>]\n", argv[0]);
         return EXIT_FAILURE;
     }
     int max_dist = atoi(argv[1]);
@@ -23,55 +23,21 @@ int main(int argc, char *argv[]) {
     int center_x;
     int center_y;
 
-    // Initialize RealSense pipeline
-    pipeline pipeline;
-    config config;
-    config.enable_stream(RS2_STREAM_DEPTH, WIDTH, HEIGHT, RS2_FORMAT_Z16, FPS);
-    pipeline.start(config);
-    device dev = pipeline.get_active_profile().get_device();
-    if (!dev) {
-        printf("No device found.\n");
+    // Initialize the frame source (RealSense camera, .bag recording or raw dump)
+    unique_ptr<FrameSource> source = open_frame_source(get_option(argc, argv, 4, "source"));
+    if (!source) {
         return EXIT_FAILURE;
     }
-    else {
-        printf("Device found.\n");
-    }
+    CaptureOptions capture_options = get_capture_options(argc, argv, 4);
     
-    // Reinitialize OpenCV matrices to accumulate depth data
-    Mat accumulated_depth = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
-    Mat valid_pixel_count = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
+    // Per-pixel statistics of the frames
+    DepthAccumulator accumulator(0, max_dist*1000, capture_options.estimator);
     
-
-    for (int frame_count = 0; frame_count < n_index; ++frame_count) {
-        // Wait for the next set of frames
-        frameset frames = pipeline.wait_for_frames();
-        depth_frame depth_frame = frames.get_depth_frame();
-
-        Mat depth_data = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
-        // Normalize depth values to max distance (in millimeters)
-        for (int i = 0; i < WIDTH; i++){
-            for (int j = 0; j < HEIGHT; j++){
-                float depth = depth_frame.get_distance(i, j);
-                if (depth >= 0) {
-                    if (depth >= max_dist) {
-                        depth_data.at<float>(j, i) = (max_dist*1000);
-                    }
-                    else {
-                        depth_data.at<float>(j, i) = depth * 1000;  // Convert depth to millimeters
-                    }
-                    valid_pixel_count.at<int>(j, i) += 1;
-                }
-                else {
-                    depth_data.at<float>(j, i) = 0;  // Set out-of-range depth to 0
-                }
-            }
-        }
-        // Accumulate depth data
-        accumulated_depth += depth_data;
-    }
+    get_main_frames_count(*source, n_index, accumulator, capture_options);
 
     // Compute the mean depth image
-    Mat average_depth = get_mean_depth(accumulated_depth, valid_pixel_count, max_dist);
+    Mat average_depth, depth_variance, valid_ratio;
+    accumulator.finalize(average_depth, depth_variance, valid_ratio);
    
     int square_x_m = WIDTH/2;
     int square_y_m = HEIGHT/2;
@@ -151,8 +117,8 @@ int main(int argc, char *argv[]) {
 
 
 
-    // Stop the pipeline
-    pipeline.stop();
+    // Stop the frame source
+    source->stop();
     
     return 0;
 }
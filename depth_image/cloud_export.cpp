@@ -0,0 +1,148 @@
+#include "resources.h"
+
+/**
+ * @brief Creates a point cloud file and writes its header.
+ *
+ * @param filename The file to write.
+ * @param format The format of the file.
+ * @param attributes The CloudAttribute flags of the points.
+ * @return true if the file was created.
+ */
+bool CloudWriter::open(const char filename[], CloudFormat format, unsigned attributes) {
+    close();
+    file = fopen(filename, "wb");
+    if (!file) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    this->format = format;
+    this->attributes = attributes;
+    row_size = 3 * sizeof(float) + ((attributes & CLOUD_IMAGE) ? sizeof(uint32_t) : 0) + ((attributes & CLOUD_VARIANCE) ? sizeof(float) : 0);
+    chunk.resize(CLOUD_CHUNK_POINTS * row_size);
+    n_rows = 0;
+    n_points = 0;
+    failed = false;
+    write_header();
+    return !failed;
+}
+
+// Writes the header, with the count padded to a fixed width so it can be rewritten in place
+void CloudWriter::write_header() {
+    unsigned long long count = n_points;
+    if (format == CLOUD_PLY) {
+        fprintf(file, "ply\nformat binary_little_endian 1.0\ncomment depth_image points, mm\n");
+        fprintf(file, "element vertex %012llu\nproperty float x\nproperty float y\nproperty float z\n", count);
+        if (attributes & CLOUD_IMAGE) {
+            fprintf(file, "property uint image\n");
+        }
+        if (attributes & CLOUD_VARIANCE) {
+            fprintf(file, "property float variance\n");
+        }
+        fprintf(file, "end_header\n");
+    } else {
+        bool image = attributes & CLOUD_IMAGE, variance = attributes & CLOUD_VARIANCE;
+        fprintf(file, "# .PCD v0.7 - Point Cloud Data file format\nVERSION 0.7\n");
+        fprintf(file, "FIELDS x y z%s%s\n", image ? " image" : "", variance ? " variance" : "");
+        fprintf(file, "SIZE 4 4 4%s%s\n", image ? " 4" : "", variance ? " 4" : "");
+        fprintf(file, "TYPE F F F%s%s\n", image ? " U" : "", variance ? " F" : "");
+        fprintf(file, "COUNT 1 1 1%s%s\n", image ? " 1" : "", variance ? " 1" : "");
+        fprintf(file, "WIDTH %012llu\nHEIGHT 1\nVIEWPOINT 0 0 0 1 0 0 0\nPOINTS %012llu\nDATA binary\n", count, count);
+    }
+    failed |= ferror(file) != 0;
+    return;
+}
+
+void CloudWriter::flush_chunk() {
+    if (n_rows > 0 && fwrite(chunk.data(), row_size, n_rows, file) != n_rows) {
+        failed = true;
+    }
+    n_rows = 0;
+    return;
+}
+
+/**
+ * @brief Appends points to the file.
+ *
+ * @param xs, ys, zs The coordinates of the points (in milimiters).
+ * @param n The number of points.
+ * @param image The image index of the points, written with CLOUD_IMAGE.
+ * @param variances The variance of each point, written with CLOUD_VARIANCE (0 if null).
+ */
+void CloudWriter::write(const float* xs, const float* ys, const float* zs, size_t n, uint32_t image, const float* variances) {
+    if (!file) {
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t* row = chunk.data() + n_rows * row_size;
+        float xyz[3] = { xs[i], ys[i], zs[i] };
+        memcpy(row, xyz, sizeof(xyz));
+        row += sizeof(xyz);
+        if (attributes & CLOUD_IMAGE) {
+            memcpy(row, &image, sizeof(image));
+            row += sizeof(image);
+        }
+        if (attributes & CLOUD_VARIANCE) {
+            float variance = variances ? variances[i] : 0.0f;
+            memcpy(row, &variance, sizeof(variance));
+        }
+        if (++n_rows == CLOUD_CHUNK_POINTS) {
+            flush_chunk();
+        }
+    }
+    n_points += n;
+    return;
+}
+
+void CloudWriter::write(const PointCloud& points, uint32_t image, const float* variances) {
+    write(points.x.data(), points.y.data(), points.z.data(), points.size(), image, variances);
+    return;
+}
+
+/**
+ * @brief Writes the remaining points and the final count, then closes the file.
+ *
+ * @return true if the whole file was written.
+ */
+bool CloudWriter::close() {
+    if (!file) {
+        return false;
+    }
+    flush_chunk();
+    if (fseek(file, 0, SEEK_SET) == 0) {
+        write_header();
+    } else {
+        failed = true;
+    }
+    failed |= fclose(file) != 0;
+    file = nullptr;
+    chunk.clear();
+    chunk.shrink_to_fit();
+    return !failed;
+}
+
+/**
+ * @brief Returns the format of a point cloud file from its extension, PLY unless it is .pcd.
+ */
+CloudFormat cloud_format(const char filename[]) {
+    const char* dot = strrchr(filename, '.');
+    return dot && strcmp(dot, ".pcd") == 0 ? CLOUD_PCD : CLOUD_PLY;
+}
+
+/**
+ * @brief Writes points to a PLY or PCD file, depending on its extension.
+ *
+ * @param filename The file to write (.ply or .pcd).
+ * @param points The points.
+ * @param attributes The CloudAttribute flags to write.
+ * @param image The image index of the points.
+ * @param variances The variance of each point, or null.
+ * @return true if the file was written.
+ */
+bool write_cloud_file(const char filename[], const PointCloud& points, unsigned attributes, uint32_t image, const float* variances) {
+    CloudWriter writer;
+    if (!writer.open(filename, cloud_format(filename), attributes)) {
+        return false;
+    }
+    writer.write(points, image, variances);
+    return writer.close();
+}
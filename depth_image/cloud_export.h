@@ -0,0 +1,63 @@
+#ifndef CLOUD_EXPORT_H
+#define CLOUD_EXPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "point_cloud.h"
+
+// Points encoded before each write, bounds the memory of a CloudWriter
+#define CLOUD_CHUNK_POINTS 16384
+
+// Standard point cloud formats, both written as binary little-endian
+enum CloudFormat {
+    CLOUD_PLY = 0,  // Stanford PLY, binary_little_endian 1.0
+    CLOUD_PCD = 1   // Point Cloud Library PCD 0.7, DATA binary
+};
+
+// Optional per-point attributes, written after x, y and z
+enum CloudAttribute : unsigned {
+    CLOUD_IMAGE = 1u << 0,     // Index of the image of the point (uint32)
+    CLOUD_VARIANCE = 1u << 1   // Variance of the depth of the pixel of the point (mm^2, float)
+};
+
+/**
+ * @brief Streams points to a PLY or PCD file.
+ *
+ * The points are packed in rows of CLOUD_CHUNK_POINTS and written chunk by chunk, so any number
+ * of points can be written with a fixed amount of memory. The number of points is not known
+ * until close(), so the header is written with a fixed width count and rewritten at the end.
+ */
+class CloudWriter {
+public:
+    CloudWriter() : file(nullptr), format(CLOUD_PLY), attributes(0), row_size(0), n_rows(0), n_points(0), failed(false) {}
+    ~CloudWriter() { close(); }
+    CloudWriter(const CloudWriter&) = delete;
+    CloudWriter& operator=(const CloudWriter&) = delete;
+
+    bool open(const char filename[], CloudFormat format, unsigned attributes);
+    void write(const float* xs, const float* ys, const float* zs, size_t n, uint32_t image = 0, const float* variances = nullptr);
+    void write(const PointCloud& points, uint32_t image = 0, const float* variances = nullptr);
+    bool close();
+    uint64_t size() const { return n_points; }
+
+private:
+    void write_header();
+    void flush_chunk();
+
+    FILE* file;
+    CloudFormat format;
+    unsigned attributes;
+    size_t row_size;
+    size_t n_rows;
+    std::vector<uint8_t> chunk;
+    uint64_t n_points;
+    bool failed;
+};
+
+CloudFormat cloud_format(const char filename[]);
+bool write_cloud_file(const char filename[], const PointCloud& points, unsigned attributes, uint32_t image = 0,
+                      const float* variances = nullptr);
+
+#endif // CLOUD_EXPORT_H
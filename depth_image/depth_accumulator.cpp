@@ -0,0 +1,174 @@
+#include "resources.h"
+
+/**
+ * @brief Creates an empty accumulator for WIDTH x HEIGHT frames.
+ *
+ * @param min_dist The minimum distance to consider for depth measurements (in milimiters).
+ * @param max_dist The maximum distance to consider for depth measurements (in milimiters).
+ * @param estimator The estimator of the depth returned by finalize().
+ */
+DepthAccumulator::DepthAccumulator(int min_dist, int max_dist, TemporalEstimator estimator)
+    : min_dist(min_dist), max_dist(max_dist), n_frames(0), estimator(estimator),
+      count(WIDTH * HEIGHT, 0), sum(WIDTH * HEIGHT, 0), sum_sq(WIDTH * HEIGHT, 0), lut_scale(0.0f) {
+    if (estimator != ESTIMATOR_MEAN) {
+        histogram.reset(new TemporalHistogram(WIDTH, HEIGHT));
+    }
+}
+
+void DepthAccumulator::reset() {
+    n_frames = 0;
+    fill(count.begin(), count.end(), 0);
+    fill(sum.begin(), sum.end(), 0);
+    fill(sum_sq.begin(), sum_sq.end(), 0);
+    if (histogram) {
+        histogram->reset();
+    }
+}
+
+/**
+ * @brief Accumulates a whole frame, split in row bands run by the OpenCV thread pool.
+ *
+ * @param frame The depth frame.
+ * @param n_workers The number of row bands, usually the OpenCV thread count (see ScopedNumThreads).
+ */
+void DepthAccumulator::add_frame(const DepthFrame& frame, int n_workers) {
+    update_lut(frame.depth_scale);
+    parallel_for_(Range(0, HEIGHT), [&](const Range& rows) {
+        add_rows(frame, rows.start, rows.end);
+    }, n_workers);
+    n_frames++;
+}
+
+/**
+ * @brief Accumulates a band of rows of one frame.
+ *
+ * Bands of the same frame may be accumulated concurrently as long as they do not overlap.
+ * When the depth unit is 1 mm (the default of the D400 cameras) the raw values are used
+ * directly in a branchless loop, otherwise they go through a lookup table.
+ *
+ * @param frame The depth frame.
+ * @param first_row The first row to accumulate.
+ * @param last_row One past the last row to accumulate.
+ */
+void DepthAccumulator::add_rows(const DepthFrame& frame, int first_row, int last_row) {
+    const bool unit_mm = frame.depth_scale == 0.001f;
+    const uint32_t min_depth = (uint32_t)max(min_dist, 1);
+    const uint32_t max_depth = (uint32_t)max_dist;
+    uint16_t depth_mm[WIDTH];
+    for (int y = first_row; y < last_row; ++y) {
+        const uint16_t* row = frame.data + (size_t)y * frame.stride;
+        uint32_t* count_row = count.data() + (size_t)y * WIDTH;
+        uint64_t* sum_row = sum.data() + (size_t)y * WIDTH;
+        uint64_t* sum_sq_row = sum_sq.data() + (size_t)y * WIDTH;
+        if (unit_mm) {
+            for (int x = 0; x < WIDTH; ++x) {
+                uint32_t depth = row[x];
+                uint32_t valid = depth >= min_depth;
+                depth = std::min(depth, max_depth) * valid;
+                depth_mm[x] = (uint16_t)depth;
+                count_row[x] += valid;
+                sum_row[x] += depth;
+                sum_sq_row[x] += depth * depth;
+            }
+        } else {
+            for (int x = 0; x < WIDTH; ++x) {
+                uint32_t depth = lut[row[x]];
+                depth_mm[x] = (uint16_t)depth;
+                count_row[x] += depth != 0;
+                sum_row[x] += depth;
+                sum_sq_row[x] += depth * depth;
+            }
+        }
+        if (histogram) {
+            histogram->add_row(y, depth_mm);
+        }
+    }
+    return;
+}
+
+/**
+ * @brief Computes the per-pixel mean, variance and valid ratio in a single pass.
+ *
+ * Pixels without any valid measurement are left at zero. Means at or above 99% of max_dist
+ * are set to max_dist, so they are discarded when the image is deprojected. With a robust
+ * estimator, mean receives the estimate of the histogram instead of the mean.
+ *
+ * @param mean The mean (or robust) depth of each pixel (CV_32FC1, in milimiters).
+ * @param variance The variance of the depth of each pixel (CV_32FC1, in squared milimiters).
+ * @param valid_ratio The fraction of the frames with a valid depth for each pixel (CV_32FC1).
+ */
+void DepthAccumulator::finalize(Mat& mean, Mat& variance, Mat& valid_ratio) const {
+    mean = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
+    variance = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
+    valid_ratio = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
+    const double inv_frames = n_frames > 0 ? 1.0 / n_frames : 0.0;
+    for (int y = 0; y < HEIGHT; ++y) {
+        float* mean_row = mean.ptr<float>(y);
+        float* variance_row = variance.ptr<float>(y);
+        float* ratio_row = valid_ratio.ptr<float>(y);
+        for (int x = 0; x < WIDTH; ++x) {
+            size_t i = (size_t)y * WIDTH + x;
+            if (count[i] == 0) {
+                continue;
+            }
+            double pixel_mean = (double)sum[i] / count[i];
+            double pixel_variance = (double)sum_sq[i] / count[i] - pixel_mean * pixel_mean;
+            mean_row[x] = pixel_mean >= 0.99 * max_dist ? (float)max_dist : (float)pixel_mean;
+            variance_row[x] = (float)std::max(pixel_variance, 0.0);
+            ratio_row[x] = (float)(count[i] * inv_frames);
+        }
+    }
+    if (histogram) {
+        histogram->finalize(mean, estimator, max_dist);
+    }
+    return;
+}
+
+/**
+ * @brief Computes the fraction of the valid pixels whose mean has converged.
+ *
+ * A pixel has converged when the standard error of its mean, sqrt(variance / count), is at
+ * most max_stderr. Pixels with fewer than 3 valid samples never count as converged.
+ *
+ * @param max_stderr The standard error to reach (in milimiters).
+ * @return double The converged pixels over the pixels with at least one valid sample.
+ */
+double DepthAccumulator::converged_fraction(double max_stderr) const {
+    const double max_stderr_sq = max_stderr * max_stderr;
+    size_t n_valid = 0, n_converged = 0;
+    for (size_t i = 0; i < count.size(); ++i) {
+        if (count[i] == 0) {
+            continue;
+        }
+        n_valid++;
+        if (count[i] >= 3) {
+            // variance / count <= max_stderr^2, with variance * count = sum_sq - sum^2 / count
+            double n = count[i];
+            double scaled_variance = (double)sum_sq[i] - (double)sum[i] * (double)sum[i] / n;
+            n_converged += scaled_variance <= max_stderr_sq * n * n;
+        }
+    }
+    return n_valid > 0 ? (double)n_converged / n_valid : 0.0;
+}
+
+/**
+ * @brief Rebuilds the raw value to millimeter lookup table when the depth unit changes.
+ *
+ * @param depth_scale The size of one depth unit (in meters).
+ */
+void DepthAccumulator::update_lut(float depth_scale) {
+    if (depth_scale == lut_scale || depth_scale == 0.001f) {
+        return;
+    }
+    lut.resize(65536);
+    for (int raw = 0; raw < 65536; raw++) {
+        long depth = lround(raw * depth_scale * 1000.0);
+        if (raw == 0 || depth < max(min_dist, 1)) {
+            lut[raw] = 0;
+        } else {
+            lut[raw] = (uint16_t)min<long>(depth, max_dist);
+        }
+    }
+    lut_scale = depth_scale;
+    return;
+}
@@ -0,0 +1,54 @@
+#ifndef DEPTH_ACCUMULATOR_H
+#define DEPTH_ACCUMULATOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "frame_source.h"
+#include "temporal_histogram.h"
+
+/**
+ * @brief Streaming per-pixel depth statistics over many frames.
+ *
+ * Depths are converted to whole millimeters and accumulated as integers (count, sum and
+ * sum of squares), so no precision is lost however many frames are averaged. Depths below
+ * min_dist or without data are not counted, depths above max_dist are clamped to max_dist.
+ * With a robust estimator the samples also go to a TemporalHistogram, which then gives the
+ * depth returned by finalize() instead of the mean.
+ */
+class DepthAccumulator {
+public:
+    DepthAccumulator(int min_dist, int max_dist, TemporalEstimator estimator = ESTIMATOR_MEAN);
+
+    void reset();
+    void add_frame(const DepthFrame& frame, int n_workers = 1);
+    void add_rows(const DepthFrame& frame, int first_row, int last_row);
+    void finalize(cv::Mat& mean, cv::Mat& variance, cv::Mat& valid_ratio) const;
+    double converged_fraction(double max_stderr) const;
+
+    int get_frames() const { return n_frames; }
+    int get_min_dist() const { return min_dist; }
+    int get_max_dist() const { return max_dist; }
+    TemporalEstimator get_estimator() const { return estimator; }
+    uint32_t get_count(int index) const { return count[index]; }
+    uint64_t get_sum(int index) const { return sum[index]; }
+    uint64_t get_sum_sq(int index) const { return sum_sq[index]; }
+
+private:
+    void update_lut(float depth_scale);
+
+    int min_dist;
+    int max_dist;
+    int n_frames;
+    TemporalEstimator estimator;
+    std::unique_ptr<TemporalHistogram> histogram;
+    std::vector<uint32_t> count;
+    std::vector<uint64_t> sum;
+    std::vector<uint64_t> sum_sq;
+    // Raw Z16 value -> clamped depth in mm (0 when invalid), used when a unit is not 1 mm
+    float lut_scale;
+    std::vector<uint16_t> lut;
+};
+
+#endif // DEPTH_ACCUMULATOR_H
@@ -0,0 +1,75 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Bounded lock-free ring for one producer thread and one consumer thread.
+ *
+ * try_push() and record_drop() may only be called by the producer, try_pop() only by the
+ * consumer. The occupancy counters can be read from any thread.
+ */
+template <typename T>
+class FrameRing {
+public:
+    explicit FrameRing(std::size_t capacity) : slots(capacity + 1), head(0), tail(0), peak_occupancy(0), dropped(0) {}
+
+    /**
+     * @brief Moves item into the ring.
+     * @return false if the ring is full, item is left untouched in that case.
+     */
+    bool try_push(T& item) {
+        std::size_t current_tail = tail.load(std::memory_order_relaxed);
+        std::size_t next_tail = increment(current_tail);
+        if (next_tail == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots[current_tail] = std::move(item);
+        tail.store(next_tail, std::memory_order_release);
+        std::size_t occupancy = size();
+        if (occupancy > peak_occupancy.load(std::memory_order_relaxed)) {
+            peak_occupancy.store(occupancy, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Moves the oldest item of the ring into item.
+     * @return false if the ring is empty.
+     */
+    bool try_pop(T& item) {
+        std::size_t current_head = head.load(std::memory_order_relaxed);
+        if (current_head == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(slots[current_head]);
+        head.store(increment(current_head), std::memory_order_release);
+        return true;
+    }
+
+    // Counts an item the producer had to discard because the ring was full
+    void record_drop() { dropped.fetch_add(1, std::memory_order_relaxed); }
+
+    std::size_t size() const {
+        std::size_t current_head = head.load(std::memory_order_acquire);
+        std::size_t current_tail = tail.load(std::memory_order_acquire);
+        return current_tail >= current_head ? current_tail - current_head : current_tail + slots.size() - current_head;
+    }
+    std::size_t capacity() const { return slots.size() - 1; }
+    std::size_t get_peak_occupancy() const { return peak_occupancy.load(std::memory_order_relaxed); }
+    uint64_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    std::size_t increment(std::size_t index) const { return index + 1 == slots.size() ? 0 : index + 1; }
+
+    std::vector<T> slots;
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+    alignas(64) std::atomic<std::size_t> peak_occupancy;
+    std::atomic<uint64_t> dropped;
+};
+
+#endif // FRAME_RING_H
@@ -0,0 +1,205 @@
+#include "resources.h"
+
+/**
+ * @brief Returns the next depth frame, the frames handed back with unread() first.
+ *
+ * @param frame The frame to fill.
+ * @return true if a frame was returned, false when the source is exhausted.
+ */
+bool FrameSource::next_frame(DepthFrame& frame) {
+    if (!unread_frames.empty()) {
+        frame = std::move(unread_frames.front());
+        unread_frames.pop_front();
+        return true;
+    }
+    return read_frame(frame);
+}
+
+/**
+ * @brief Hands back frames that were read but not used, next_frame() returns them again in order.
+ *
+ * The pixels of the frames that point into a librealsense buffer are copied, so the frames
+ * kept here do not hold buffers of the pipeline.
+ *
+ * @param frames The frames, oldest first, moved out of the vector.
+ */
+void FrameSource::unread(vector<DepthFrame>& frames) {
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+        DepthFrame& frame = *it;
+        if (frame.data && frame.data != frame.buffer.data()) {
+            vector<uint16_t> pixels((size_t)frame.width * frame.height);
+            for (int y = 0; y < frame.height; y++) {
+                memcpy(pixels.data() + (size_t)y * frame.width, frame.data + (size_t)y * frame.stride, frame.width * sizeof(uint16_t));
+            }
+            frame.buffer.swap(pixels);
+            frame.handle = rs2::frame();
+            frame.data = frame.buffer.data();
+            frame.stride = frame.width;
+        }
+        unread_frames.push_front(std::move(frame));
+    }
+    frames.clear();
+    return;
+}
+
+/**
+ * @brief Starts a RealSense pipeline on the connected camera or on a .bag recording.
+ *
+ * Recordings are played back as fast as they can be read (not in real time) and are
+ * not repeated, so next_frame() returns false once the whole file has been consumed.
+ *
+ * @param bag_filename The .bag file to play back, or an empty string to use the camera.
+ * @throws rs2::error If the pipeline can not be started.
+ * @throws std::runtime_error If the depth stream does not have the expected resolution.
+ */
+RealSenseSource::RealSenseSource(const string& bag_filename) : live(bag_filename.empty()), running(false) {
+    config config;
+    if (live) {
+        config.enable_stream(RS2_STREAM_DEPTH, WIDTH, HEIGHT, RS2_FORMAT_Z16, FPS);
+    } else {
+        config.enable_device_from_file(bag_filename, false);
+        config.enable_stream(RS2_STREAM_DEPTH);
+    }
+    pipeline_profile profile = pipe.start(config);
+    running = true;
+    device dev = profile.get_device();
+    if (!live) {
+        dev.as<playback>().set_real_time(false);
+    }
+    intrinsics = profile.get_stream(RS2_STREAM_DEPTH).as<video_stream_profile>().get_intrinsics();
+    if (intrinsics.width != WIDTH || intrinsics.height != HEIGHT) {
+        throw runtime_error("Depth stream is " + to_string(intrinsics.width) + "x" + to_string(intrinsics.height) +
+                            ", expected " + to_string(WIDTH) + "x" + to_string(HEIGHT));
+    }
+}
+
+RealSenseSource::~RealSenseSource() {
+    stop();
+}
+
+/**
+ * @brief Waits for the next depth frame of the pipeline.
+ *
+ * @param frame The frame to fill, it keeps a reference to the librealsense buffer.
+ * @return true if a frame was received, false if the recording ended or the camera timed out.
+ */
+bool RealSenseSource::read_frame(DepthFrame& frame) {
+    frameset frames;
+    if (!running || !pipe.try_wait_for_frames(&frames)) {
+        return false;
+    }
+    depth_frame depth = frames.get_depth_frame();
+    frame.handle = depth;
+    frame.buffer.clear();
+    frame.data = static_cast<const uint16_t*>(depth.get_data());
+    frame.width = depth.get_width();
+    frame.height = depth.get_height();
+    frame.stride = depth.get_stride_in_bytes() / sizeof(uint16_t);
+    frame.depth_scale = depth.get_units();
+    return true;
+}
+
+void RealSenseSource::stop() {
+    if (running) {
+        pipe.stop();
+        running = false;
+    }
+}
+
+/**
+ * @brief Opens a raw Z16 dump and reads its intrinsics file.
+ *
+ * If either file can not be read the source is left closed, check is_open().
+ *
+ * @param dump_filename The raw dump, its intrinsics are read from "<dump_filename>.txt".
+ */
+RawDumpSource::RawDumpSource(const string& dump_filename) : intrinsics(), depth_scale(0.001f) {
+    ifstream intrinsics_file(dump_filename + ".txt");
+    if (!intrinsics_file.is_open()) {
+        cerr << "Error opening intrinsics file " << dump_filename << ".txt" << endl;
+        return;
+    }
+    string line;
+    getline(intrinsics_file, line);
+    stringstream ss(line);
+    string item;
+    vector<float> values;
+    while (getline(ss, item, ',')) {
+        try {
+            values.push_back(stof(item));
+        } catch (const invalid_argument&) {
+            break;
+        }
+    }
+    if (values.size() != 13) {
+        cerr << "Invalid intrinsics line: " << line << endl;
+        return;
+    }
+    intrinsics.width = (int)values[0];
+    intrinsics.height = (int)values[1];
+    intrinsics.ppx = values[2];
+    intrinsics.ppy = values[3];
+    intrinsics.fx = values[4];
+    intrinsics.fy = values[5];
+    intrinsics.model = (rs2_distortion)(int)values[6];
+    for (int i = 0; i < 5; i++) {
+        intrinsics.coeffs[i] = values[7 + i];
+    }
+    depth_scale = values[12];
+    if (intrinsics.width != WIDTH || intrinsics.height != HEIGHT) {
+        cerr << "Raw dump is " << intrinsics.width << "x" << intrinsics.height << ", expected " << WIDTH << "x" << HEIGHT << endl;
+        return;
+    }
+    file.open(dump_filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening raw dump " << dump_filename << endl;
+    }
+}
+
+/**
+ * @brief Reads the next frame of the dump.
+ *
+ * @param frame The frame to fill, it owns a copy of the pixels.
+ * @return true if a whole frame was read, false at the end of the file.
+ */
+bool RawDumpSource::read_frame(DepthFrame& frame) {
+    const streamsize bytes = (streamsize)WIDTH * HEIGHT * sizeof(uint16_t);
+    frame.handle = rs2::frame();
+    frame.buffer.resize((size_t)WIDTH * HEIGHT);
+    if (!file.read(reinterpret_cast<char*>(frame.buffer.data()), bytes)) {
+        return false;
+    }
+    frame.data = frame.buffer.data();
+    frame.width = WIDTH;
+    frame.height = HEIGHT;
+    frame.stride = WIDTH;
+    frame.depth_scale = depth_scale;
+    return true;
+}
+
+/**
+ * @brief Opens the frame source selected on the command line.
+ *
+ * @param source_filename A .bag recording, a raw Z16 dump, or nullptr to use the camera.
+ * @return The opened source, or nullptr if it could not be opened.
+ */
+unique_ptr<FrameSource> open_frame_source(const char source_filename[]) {
+    string filename = source_filename ? source_filename : "";
+    if (filename.empty() || (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".bag") == 0)) {
+        try {
+            unique_ptr<FrameSource> source(new RealSenseSource(filename));
+            #if DEBUG
+            printf(filename.empty() ? "Device found.\n" : "Recording opened.\n");
+            #endif
+            return source;
+        } catch (const exception& e) {
+            printf("No device found: %s\n", e.what());
+            return nullptr;
+        }
+    }
+    unique_ptr<RawDumpSource> source(new RawDumpSource(filename));
+    if (!source->is_open()) {
+        return nullptr;
+    }
+    return source;
+}
@@ -0,0 +1,95 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <deque>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <librealsense2/rs.hpp>
+
+using namespace std;
+using namespace rs2;
+
+/**
+ * @brief One Z16 depth frame, independent of where it came from.
+ *
+ * Frames coming from librealsense keep their buffer alive through the frame handle,
+ * frames read from a raw dump own their pixels in buffer. In both cases data points
+ * to the first pixel and rows are stride elements apart.
+ */
+struct DepthFrame {
+    frame handle;
+    vector<uint16_t> buffer;
+    const uint16_t* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    float depth_scale = 0.001f;
+};
+
+/**
+ * @brief Source of depth frames used by get_main_frames_count().
+ */
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+    // Fills frame with the next depth frame, returns false when the source is exhausted
+    bool next_frame(DepthFrame& frame);
+    void unread(vector<DepthFrame>& frames);
+    virtual rs2_intrinsics get_intrinsics() const = 0;
+    // True when frames arrive in real time and are lost if they are not read
+    virtual bool is_live() const { return false; }
+    virtual void stop() {}
+
+protected:
+    // Reads the next frame of the source itself
+    virtual bool read_frame(DepthFrame& frame) = 0;
+
+private:
+    // Frames handed back by unread(), returned before reading the source again
+    deque<DepthFrame> unread_frames;
+};
+
+/**
+ * @brief Frames from a RealSense camera, or from a librealsense .bag recording.
+ */
+class RealSenseSource : public FrameSource {
+public:
+    explicit RealSenseSource(const string& bag_filename = "");
+    ~RealSenseSource() override;
+    rs2_intrinsics get_intrinsics() const override { return intrinsics; }
+    bool is_live() const override { return live; }
+    void stop() override;
+protected:
+    bool read_frame(DepthFrame& frame) override;
+private:
+    pipeline pipe;
+    rs2_intrinsics intrinsics;
+    bool live;
+    bool running;
+};
+
+/**
+ * @brief Frames from a raw Z16 dump: consecutive WIDTH x HEIGHT uint16_t frames.
+ *
+ * The intrinsics are read from "<dump filename>.txt", a single line in the format
+ * width,height,ppx,ppy,fx,fy,model,coeff0,coeff1,coeff2,coeff3,coeff4,depth_scale
+ */
+class RawDumpSource : public FrameSource {
+public:
+    explicit RawDumpSource(const string& dump_filename);
+    rs2_intrinsics get_intrinsics() const override { return intrinsics; }
+    bool is_open() const { return file.is_open(); }
+protected:
+    bool read_frame(DepthFrame& frame) override;
+private:
+    ifstream file;
+    rs2_intrinsics intrinsics;
+    float depth_scale;
+};
+
+unique_ptr<FrameSource> open_frame_source(const char source_filename[]);
+
+#endif // FRAME_SOURCE_H
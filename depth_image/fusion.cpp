@@ -0,0 +1,70 @@
+#include "resources.h"
+
+/**
+ * @brief Fits the noise model on the measurements of a calibration file.
+ *
+ * The file is the one appended to by calibration: blocks of "Average: <depth> mm" and
+ * "Stdd: <standard deviation> mm" lines.
+ *
+ * @param filename The calibration file.
+ * @return true if the file held at least two measurements, otherwise the model is left unchanged.
+ */
+bool NoiseModel::load(const char filename[]) {
+    TextReader reader;
+    if (!reader.open(filename)) {
+        return false;
+    }
+    const char *line_begin, *line_end;
+    double depth = -1.0, value;
+    // Sums of the least squares fit of sigma on [1, d^2] (d in m)
+    double n = 0.0, sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+    while (reader.next_line(line_begin, line_end)) {
+        size_t length = line_end - line_begin;
+        if (length > 8 && strncmp(line_begin, "Average:", 8) == 0 && parse_values(line_begin + 8, line_end, &value, 1) == 1) {
+            depth = value;
+        } else if (length > 5 && strncmp(line_begin, "Stdd:", 5) == 0 && parse_values(line_begin + 5, line_end, &value, 1) == 1 && depth > 0) {
+            double x = depth * depth * 1e-6;
+            n += 1.0;
+            sum_x += x;
+            sum_y += value;
+            sum_xx += x * x;
+            sum_xy += x * value;
+            depth = -1.0;
+        }
+    }
+    double determinant = n * sum_xx - sum_x * sum_x;
+    if (n < 2 || determinant <= 0) {
+        return false;
+    }
+    quadratic = max(0.0, (n * sum_xy - sum_x * sum_y) / determinant);
+    sigma0 = max((double)NOISE_MIN_SIGMA, (sum_y - quadratic * sum_x) / n);
+    return true;
+}
+
+/**
+ * @brief Computes the weight (inverse of the noise variance) of each point.
+ *
+ * The noise of a point is taken as the noise of the depth at its distance from the camera.
+ *
+ * @param xs The x coordinates of the world frame points.
+ * @param ys The y coordinates of the world frame points.
+ * @param zs The z coordinates of the world frame points.
+ * @param n_points The number of points.
+ * @param camera_position The position of the camera in the world frame.
+ * @param weights Receives one weight per point (1 / mm^2).
+ */
+void NoiseModel::point_weights(const float* xs, const float* ys, const float* zs, size_t n_points, const Vector3f& camera_position,
+                               vector<float>& weights) const {
+    weights.resize(n_points);
+    float cx = camera_position(0), cy = camera_position(1), cz = camera_position(2);
+    for (size_t i = 0; i < n_points; ++i) {
+        float dx = xs[i] - cx, dy = ys[i] - cy, dz = zs[i] - cz;
+        weights[i] = weight(dx * dx + dy * dy + dz * dz);
+    }
+    return;
+}
+
+void NoiseModel::point_weights(const PointCloud& points, const Vector3f& camera_position, vector<float>& weights) const {
+    point_weights(points.x.data(), points.y.data(), points.z.data(), points.size(), camera_position, weights);
+    return;
+}
@@ -0,0 +1,44 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <algorithm>
+#include <vector>
+#include <Eigen/Dense>
+#include "point_cloud.h"
+
+// Default noise model, fitted on data_calibration/params_calibration.txt
+#define NOISE_DEFAULT_SIGMA0 47.3     // mm
+#define NOISE_DEFAULT_QUADRATIC 2.75  // mm / m^2
+// Smallest standard deviation given to a point (mm)
+#define NOISE_MIN_SIGMA 1.0f
+
+/**
+ * @brief Depth noise of the camera as a function of the distance: sigma(d) = sigma0 + quadratic * d^2.
+ *
+ * The quadratic term is the usual stereo model, the depth error grows with the square of the
+ * distance. Both terms are fitted by least squares on the measurements written by calibration.
+ */
+struct NoiseModel {
+    double sigma0 = NOISE_DEFAULT_SIGMA0;      // mm
+    double quadratic = NOISE_DEFAULT_QUADRATIC;  // mm / m^2
+
+    bool load(const char filename[]);
+    void point_weights(const float* xs, const float* ys, const float* zs, size_t n_points, const Eigen::Vector3f& camera_position,
+                       std::vector<float>& weights) const;
+    void point_weights(const PointCloud& points, const Eigen::Vector3f& camera_position, std::vector<float>& weights) const;
+
+    // Inverse of the noise variance (1 / mm^2) of a point at a squared distance (mm^2) from the camera
+    float weight(float distance_sq) const {
+        float sigma = std::max(NOISE_MIN_SIGMA, (float)(sigma0 + quadratic * 1e-6 * distance_sq));
+        return 1.0f / (sigma * sigma);
+    }
+};
+
+// Settings of the fusion of the images into the combined heightmap
+struct FusionOptions {
+    bool enabled = false;
+    float gate = 3.0f;  // Largest difference fused, in standard deviations (0 fuses every cell)
+    NoiseModel noise;
+};
+
+#endif // FUSION_H
@@ -0,0 +1,566 @@
+#include "resources.h"
+#include <cfloat>
+
+/**
+ * @brief Creates an empty heightmap.
+ *
+ * @param cell_dim The dimension of each cell (in milimiters).
+ */
+TiledHeightmap::TiledHeightmap(int cell_dim)
+    : cell_dim(cell_dim), last_key(0), last_tile(SIZE_MAX),
+      min_cx(INT_MAX), min_cy(INT_MAX), max_cx(INT_MIN), max_cy(INT_MIN) {}
+
+/**
+ * @brief Bins one world point, keeping the highest z value of each cell.
+ *
+ * Like the dense matrices of the text dumps, z values within MAX_ERROR of zero are ignored.
+ *
+ * @param x The x coordinate of the point (in milimiters).
+ * @param y The y coordinate of the point (in milimiters).
+ * @param z The z coordinate of the point (in milimiters).
+ * @param weight The inverse of the noise variance of the point (1 / mm^2), 0 to leave it out of the fused layers.
+ */
+void TiledHeightmap::add_point(float x, float y, float z, float weight) {
+    int z_value = z;
+    if (abs(z_value) <= MAX_ERROR) {
+        return;
+    }
+    add_cell(cell_x(x), cell_y(y), z_value, weight);
+    return;
+}
+
+/**
+ * @brief Finds the tile of a cell, allocating it on first touch, and extends the bounds.
+ *
+ * @return size_t The index of the tile in tiles.
+ */
+size_t TiledHeightmap::touch_cell(int cx, int cy) {
+    int tx = heightmap_tile_of(cx);
+    int ty = heightmap_tile_of(cy);
+    uint64_t key = tile_key(tx, ty);
+    if (last_tile == SIZE_MAX || key != last_key) {
+        last_tile = get_tile_index(tx, ty);
+        last_key = key;
+    }
+    min_cx = min(min_cx, cx);
+    min_cy = min(min_cy, cy);
+    max_cx = max(max_cx, cx);
+    max_cy = max(max_cy, cy);
+    return last_tile;
+}
+
+/**
+ * @brief Adds a value to a cell, updating every layer.
+ *
+ * The mean and the variance are updated with Welford's method, so they stay accurate without
+ * keeping the values. The fused layers are a sequential Kalman update written in information
+ * form, which makes it a sum: the weight is added to the information of the cell.
+ *
+ * @param cx The cell column.
+ * @param cy The cell row.
+ * @param z_value The value, not 0.
+ * @param weight The inverse of the noise variance of the value (1 / mm^2), 0 to leave it out of the fused layers.
+ */
+void TiledHeightmap::add_cell(int cx, int cy, int z_value, float weight) {
+    Tile& tile = tiles[touch_cell(cx, cy)];
+    int i = (cy & (HEIGHTMAP_TILE - 1)) * HEIGHTMAP_TILE + (cx & (HEIGHTMAP_TILE - 1));
+    if (tile.cells[i] < z_value || tile.cells[i] == 0) {
+        tile.cells[i] = z_value;
+    }
+    if (tile.min_z[i] > z_value || tile.min_z[i] == 0) {
+        tile.min_z[i] = z_value;
+    }
+    uint32_t n = ++tile.count[i];
+    float delta = z_value - tile.mean[i];
+    tile.mean[i] += delta / n;
+    tile.m2[i] += delta * (z_value - tile.mean[i]);
+    tile.weight[i] += weight;
+    tile.weighted_z[i] += weight * z_value;
+    return;
+}
+
+// Combines the statistics of the cell j of source into the cell i of tile (Chan et al.)
+static inline void merge_cell(TiledHeightmap::Tile& tile, int i, const TiledHeightmap::Tile& source, int j) {
+    uint32_t n_b = source.count[j];
+    if (n_b == 0) {
+        return;
+    }
+    uint32_t n_a = tile.count[i];
+    uint32_t n = n_a + n_b;
+    float delta = source.mean[j] - tile.mean[i];
+    tile.mean[i] += delta * n_b / n;
+    tile.m2[i] += source.m2[j] + delta * delta * ((float)n_a * n_b / n);
+    tile.count[i] = n;
+    return;
+}
+
+/**
+ * @brief Adds a cell of another heightmap to a cell, combining every layer.
+ *
+ * @param cx The cell column.
+ * @param cy The cell row.
+ * @param source The tile of the other heightmap.
+ * @param source_index The index of the cell in source, not empty.
+ */
+void TiledHeightmap::add_cell(int cx, int cy, const Tile& source, int source_index) {
+    Tile& tile = tiles[touch_cell(cx, cy)];
+    int i = (cy & (HEIGHTMAP_TILE - 1)) * HEIGHTMAP_TILE + (cx & (HEIGHTMAP_TILE - 1));
+    int high = source.cells[source_index];
+    int low = source.min_z[source_index];
+    if (tile.cells[i] < high || tile.cells[i] == 0) {
+        tile.cells[i] = high;
+    }
+    if (tile.min_z[i] > low || tile.min_z[i] == 0) {
+        tile.min_z[i] = low;
+    }
+    merge_cell(tile, i, source, source_index);
+    tile.weight[i] += source.weight[source_index];
+    tile.weighted_z[i] += source.weighted_z[source_index];
+    return;
+}
+
+/**
+ * @brief Bins point columns, split over n_workers threads.
+ *
+ * Each thread bins its share of the points into a private heightmap, then the private
+ * heightmaps are merged into this one. The highest and lowest z and the count are order
+ * independent, so they are the same as binning the points one by one with add_point(); the
+ * mean and the variance are equal up to rounding.
+ *
+ * @param xs The x coordinates of the points.
+ * @param ys The y coordinates of the points.
+ * @param zs The z coordinates of the points.
+ * @param n_points The number of points.
+ * @param n_workers The number of threads to use, 0 uses the OpenCV thread count.
+ * @param weights The inverse of the noise variance of each point, null to leave them out of the fused layers.
+ */
+void TiledHeightmap::add_points(const float* xs, const float* ys, const float* zs, size_t n_points, int n_workers, const float* weights) {
+    ScopedNumThreads threads(n_workers);
+    int n_shards = (int)min<size_t>(max(1, getNumThreads()), n_points / HEIGHTMAP_MIN_SHARD_POINTS);
+    if (n_shards <= 1) {
+        for (size_t i = 0; i < n_points; ++i) {
+            add_point(xs[i], ys[i], zs[i], weights ? weights[i] : 0.0f);
+        }
+        return;
+    }
+    vector<TiledHeightmap> shards(n_shards, TiledHeightmap(cell_dim));
+    parallel_for_(Range(0, n_shards), [&](const Range& range) {
+        for (int shard = range.start; shard < range.end; ++shard) {
+            size_t first = n_points * shard / n_shards;
+            size_t last = n_points * (shard + 1) / n_shards;
+            for (size_t i = first; i < last; ++i) {
+                shards[shard].add_point(xs[i], ys[i], zs[i], weights ? weights[i] : 0.0f);
+            }
+        }
+    }, n_shards);
+    for (const TiledHeightmap& shard : shards) {
+        merge(shard);
+    }
+    return;
+}
+
+void TiledHeightmap::add_points(const PointCloud& points, int n_workers, const float* weights) {
+    add_points(points.x.data(), points.y.data(), points.z.data(), points.size(), n_workers, weights);
+}
+
+/**
+ * @brief Merges another heightmap of the same cell dimension, combining every layer.
+ *
+ * Each cell keeps the highest and lowest z of both, and the count, mean and variance of the
+ * points of both. Empty cells (0) never overwrite a value. The fused layers are added, which
+ * is the Kalman update of the fused z of this heightmap by the fused z of the other one.
+ * With a gate, a cell of the other heightmap whose fused z differs from the fused z of this
+ * one by more than fusion_gate standard deviations of the difference is not fused.
+ *
+ * @param other The heightmap to merge into this one.
+ * @param fusion_gate The gate, in standard deviations, 0 fuses every cell.
+ * @return uint64_t The number of cells left out of the fusion by the gate.
+ */
+uint64_t TiledHeightmap::merge(const TiledHeightmap& other, float fusion_gate) {
+    float gate_sq = fusion_gate > 0.0f ? fusion_gate * fusion_gate : FLT_MAX;
+    uint64_t n_gated = 0;
+    for (const Tile& other_tile : other.tiles) {
+        Tile& tile = tiles[get_tile_index(other_tile.tx, other_tile.ty)];
+        int* cells = tile.cells.data();
+        int* min_z = tile.min_z.data();
+        const int* other_cells = other_tile.cells.data();
+        const int* other_min_z = other_tile.min_z.data();
+        for (int i = 0; i < HEIGHTMAP_TILE * HEIGHTMAP_TILE; ++i) {
+            int value = other_cells[i];
+            int cell = cells[i];
+            cells[i] = (value != 0 && (cell == 0 || cell < value)) ? value : cell;
+            value = other_min_z[i];
+            cell = min_z[i];
+            min_z[i] = (value != 0 && (cell == 0 || cell > value)) ? value : cell;
+        }
+        for (int i = 0; i < HEIGHTMAP_TILE * HEIGHTMAP_TILE; ++i) {
+            merge_cell(tile, i, other_tile, i);
+        }
+        float* weight = tile.weight.data();
+        float* weighted_z = tile.weighted_z.data();
+        const float* other_weight = other_tile.weight.data();
+        const float* other_weighted_z = other_tile.weighted_z.data();
+        uint64_t tile_gated = 0;
+        for (int i = 0; i < HEIGHTMAP_TILE * HEIGHTMAP_TILE; ++i) {
+            // The variance of the difference is 1 / w_a + 1 / w_b = (w_a + w_b) / (w_a * w_b)
+            float w_a = weight[i], w_b = other_weight[i];
+            float innovation = other_weighted_z[i] / max(w_b, FLT_MIN) - weighted_z[i] / max(w_a, FLT_MIN);
+            bool inside = w_a == 0.0f || innovation * innovation * w_a * w_b <= gate_sq * (w_a + w_b);
+            weight[i] += inside ? w_b : 0.0f;
+            weighted_z[i] += inside ? other_weighted_z[i] : 0.0f;
+            tile_gated += !inside && w_b > 0.0f;
+        }
+        n_gated += tile_gated;
+    }
+    min_cx = min(min_cx, other.min_cx);
+    min_cy = min(min_cy, other.min_cy);
+    max_cx = max(max_cx, other.max_cx);
+    max_cy = max(max_cy, other.max_cy);
+    return n_gated;
+}
+
+/**
+ * @brief Returns the highest z of a cell, 0 if its tile was never touched.
+ */
+int TiledHeightmap::get(int cx, int cy) const {
+    const int* tile = find_tile(heightmap_tile_of(cx), heightmap_tile_of(cy));
+    if (!tile) {
+        return 0;
+    }
+    return tile[(cy & (HEIGHTMAP_TILE - 1)) * HEIGHTMAP_TILE + (cx & (HEIGHTMAP_TILE - 1))];
+}
+
+int* TiledHeightmap::find_tile(int tx, int ty) {
+    auto it = tile_index.find(tile_key(tx, ty));
+    return it == tile_index.end() ? nullptr : tiles[it->second].cells.data();
+}
+
+const int* TiledHeightmap::find_tile(int tx, int ty) const {
+    auto it = tile_index.find(tile_key(tx, ty));
+    return it == tile_index.end() ? nullptr : tiles[it->second].cells.data();
+}
+
+/**
+ * @brief Returns the highest z layer of a tile, allocating an empty tile on first touch.
+ */
+int* TiledHeightmap::get_tile(int tx, int ty) {
+    return tiles[get_tile_index(tx, ty)].cells.data();
+}
+
+/**
+ * @brief Overwrites one layer of a tile, allocating an empty tile on first touch.
+ *
+ * Used to restore a heightmap from its stored layers: only the layers kept by the tiles
+ * (highest and lowest z, count, mean and the raw accumulators) can be set. Setting the count
+ * extends the bounds to the cells holding points.
+ *
+ * @param tx The tile column.
+ * @param ty The tile row.
+ * @param layer The layer.
+ * @param values The HEIGHTMAP_TILE x HEIGHTMAP_TILE values, of heightmap_layer_type(layer).
+ */
+void TiledHeightmap::set_tile_layer(int tx, int ty, HeightmapLayer layer, const void* values) {
+    Tile& tile = tiles[get_tile_index(tx, ty)];
+    size_t size = HEIGHTMAP_TILE * HEIGHTMAP_TILE * sizeof(float);
+    switch (layer) {
+    case HEIGHTMAP_MAX: memcpy(tile.cells.data(), values, size); break;
+    case HEIGHTMAP_MIN: memcpy(tile.min_z.data(), values, size); break;
+    case HEIGHTMAP_MEAN: memcpy(tile.mean.data(), values, size); break;
+    case HEIGHTMAP_M2: memcpy(tile.m2.data(), values, size); break;
+    case HEIGHTMAP_WEIGHT: memcpy(tile.weight.data(), values, size); break;
+    case HEIGHTMAP_WEIGHTED_Z: memcpy(tile.weighted_z.data(), values, size); break;
+    case HEIGHTMAP_COUNT: {
+        const int* counts = static_cast<const int*>(values);
+        for (int i = 0; i < HEIGHTMAP_TILE * HEIGHTMAP_TILE; ++i) {
+            tile.count[i] = counts[i];
+            if (counts[i] > 0) {
+                int cx = tx * HEIGHTMAP_TILE + (i & (HEIGHTMAP_TILE - 1));
+                int cy = ty * HEIGHTMAP_TILE + (i >> HEIGHTMAP_TILE_BITS);
+                min_cx = min(min_cx, cx);
+                min_cy = min(min_cy, cy);
+                max_cx = max(max_cx, cx);
+                max_cy = max(max_cy, cy);
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return;
+}
+
+size_t TiledHeightmap::get_tile_index(int tx, int ty) {
+    auto inserted = tile_index.emplace(tile_key(tx, ty), tiles.size());
+    if (inserted.second) {
+        Tile tile;
+        tile.tx = tx;
+        tile.ty = ty;
+        tile.cells.assign(HEIGHTMAP_TILE * HEIGHTMAP_TILE, 0);
+        tile.min_z.assign(HEIGHTMAP_TILE * HEIGHTMAP_TILE, 0);
+        tile.count.assign(HEIGHTMAP_TILE * HEIGHTMAP_TILE, 0);
+        tile.mean.assign(HEIGHTMAP_TILE * HEIGHTMAP_TILE, 0.0f);
+        tile.m2.assign(HEIGHTMAP_TILE * HEIGHTMAP_TILE, 0.0f);
+        tile.weight.assign(HEIGHTMAP_TILE * HEIGHTMAP_TILE, 0.0f);
+        tile.weighted_z.assign(HEIGHTMAP_TILE * HEIGHTMAP_TILE, 0.0f);
+        tiles.push_back(std::move(tile));
+    }
+    return inserted.first->second;
+}
+
+/**
+ * @brief Returns the range of the cells written so far.
+ *
+ * @return false if no cell was written.
+ */
+bool TiledHeightmap::bounds(int& min_cx, int& min_cy, int& max_cx, int& max_cy) const {
+    if (this->min_cx > this->max_cx) {
+        return false;
+    }
+    min_cx = this->min_cx;
+    min_cy = this->min_cy;
+    max_cx = this->max_cx;
+    max_cy = this->max_cy;
+    return true;
+}
+
+/**
+ * @brief Computes the smallest dense layout holding the written cells.
+ *
+ * Like the matrices built from maxAbsX and maxAbsY, the columns are centered on x = 0 and the
+ * last row is y = 0 (or the lowest written row if it is below 0).
+ *
+ * @return HeightmapLayout The layout.
+ */
+HeightmapLayout TiledHeightmap::layout() const {
+    HeightmapLayout layout;
+    int x0, y0, x1, y1;
+    if (!bounds(x0, y0, x1, y1)) {
+        return layout;
+    }
+    int half_cols = max(-x0, x1);
+    layout.center_col = max(half_cols, 0);
+    layout.n_cols = 2 * layout.center_col + 1;
+    layout.center_row = max(y1, 0);
+    layout.n_rows = layout.center_row - min(y0, 0) + 1;
+    return layout;
+}
+
+/**
+ * @brief Returns the name of a layer, as used in the reports.
+ */
+const char* heightmap_layer_name(HeightmapLayer layer) {
+    switch (layer) {
+    case HEIGHTMAP_MIN: return "min";
+    case HEIGHTMAP_MEAN: return "mean";
+    case HEIGHTMAP_COUNT: return "count";
+    case HEIGHTMAP_VARIANCE: return "variance";
+    case HEIGHTMAP_FUSED: return "fused";
+    case HEIGHTMAP_FUSED_VARIANCE: return "fused_variance";
+    case HEIGHTMAP_M2: return "m2";
+    case HEIGHTMAP_WEIGHT: return "weight";
+    case HEIGHTMAP_WEIGHTED_Z: return "weighted_z";
+    default: return "max";
+    }
+}
+
+/**
+ * @brief Returns the type of the values of a layer: CV_32SC1 or CV_32FC1, both 4 bytes.
+ */
+int heightmap_layer_type(HeightmapLayer layer) {
+    switch (layer) {
+    case HEIGHTMAP_MEAN:
+    case HEIGHTMAP_VARIANCE:
+    case HEIGHTMAP_FUSED:
+    case HEIGHTMAP_FUSED_VARIANCE:
+    case HEIGHTMAP_M2:
+    case HEIGHTMAP_WEIGHT:
+    case HEIGHTMAP_WEIGHTED_Z:
+        return CV_32FC1;
+    default:
+        return CV_32SC1;
+    }
+}
+
+// Fills the cells of a tile with one statistic
+template <typename T, typename Layer>
+static void fill_tile_layer(T* values, Layer layer) {
+    for (int i = 0; i < HEIGHTMAP_TILE * HEIGHTMAP_TILE; ++i) {
+        values[i] = layer(i);
+    }
+}
+
+/**
+ * @brief Computes one layer of a tile.
+ *
+ * @param tile The tile.
+ * @param layer The layer.
+ * @param values Receives the HEIGHTMAP_TILE x HEIGHTMAP_TILE values, of heightmap_layer_type(layer), 0 on the empty cells.
+ */
+void heightmap_tile_layer(const TiledHeightmap::Tile& tile, HeightmapLayer layer, void* values) {
+    int* ints = static_cast<int*>(values);
+    float* floats = static_cast<float*>(values);
+    switch (layer) {
+    case HEIGHTMAP_MIN:
+        memcpy(ints, tile.min_z.data(), HEIGHTMAP_TILE * HEIGHTMAP_TILE * sizeof(int));
+        break;
+    case HEIGHTMAP_MEAN:
+        memcpy(floats, tile.mean.data(), HEIGHTMAP_TILE * HEIGHTMAP_TILE * sizeof(float));
+        break;
+    case HEIGHTMAP_COUNT:
+        fill_tile_layer(ints, [&](int i) { return (int)tile.count[i]; });
+        break;
+    case HEIGHTMAP_VARIANCE:
+        fill_tile_layer(floats, [&](int i) { return tile.count[i] > 1 ? tile.m2[i] / tile.count[i] : 0.0f; });
+        break;
+    case HEIGHTMAP_FUSED:
+        fill_tile_layer(floats, [&](int i) { return tile.weight[i] > 0.0f ? tile.weighted_z[i] / tile.weight[i] : 0.0f; });
+        break;
+    case HEIGHTMAP_FUSED_VARIANCE:
+        fill_tile_layer(floats, [&](int i) { return tile.weight[i] > 0.0f ? 1.0f / tile.weight[i] : 0.0f; });
+        break;
+    case HEIGHTMAP_M2:
+        memcpy(floats, tile.m2.data(), HEIGHTMAP_TILE * HEIGHTMAP_TILE * sizeof(float));
+        break;
+    case HEIGHTMAP_WEIGHT:
+        memcpy(floats, tile.weight.data(), HEIGHTMAP_TILE * HEIGHTMAP_TILE * sizeof(float));
+        break;
+    case HEIGHTMAP_WEIGHTED_Z:
+        memcpy(floats, tile.weighted_z.data(), HEIGHTMAP_TILE * HEIGHTMAP_TILE * sizeof(float));
+        break;
+    default:
+        memcpy(ints, tile.cells.data(), HEIGHTMAP_TILE * HEIGHTMAP_TILE * sizeof(int));
+        break;
+    }
+    return;
+}
+
+/**
+ * @brief Renders one layer of the heightmap into a dense matrix.
+ *
+ * @param layout Where the cells go in the matrix, cells outside of it are left out.
+ * @param matrix Receives the layer (layout.n_rows x layout.n_cols, of heightmap_layer_type(layer)).
+ * @param layer The layer, the highest z by default. Empty cells are 0 in every layer.
+ */
+void TiledHeightmap::to_mat(const HeightmapLayout& layout, Mat& matrix, HeightmapLayer layer) const {
+    matrix = Mat::zeros(layout.n_rows, layout.n_cols, heightmap_layer_type(layer));
+    vector<uint32_t> values(HEIGHTMAP_TILE * HEIGHTMAP_TILE);
+    for (const Tile& tile : tiles) {
+        int cx0 = tile.tx * HEIGHTMAP_TILE;
+        int col0 = layout.center_col + cx0;
+        int first = max(0, -col0);
+        int last = min(HEIGHTMAP_TILE, layout.n_cols - col0);
+        int row0 = layout.center_row - tile.ty * HEIGHTMAP_TILE;
+        if (first >= last || row0 < 0 || row0 - HEIGHTMAP_TILE + 1 >= layout.n_rows) {
+            continue;
+        }
+        heightmap_tile_layer(tile, layer, values.data());
+        for (int y = 0; y < HEIGHTMAP_TILE; ++y) {
+            int row = row0 - y;
+            if (row < 0 || row >= layout.n_rows) {
+                continue;
+            }
+            memcpy(matrix.ptr<uint32_t>(row) + col0 + first, values.data() + y * HEIGHTMAP_TILE + first, (last - first) * sizeof(uint32_t));
+        }
+    }
+    return;
+}
+
+/**
+ * @brief Computes the smallest layout holding two layouts of the same cells.
+ */
+HeightmapLayout merge_layouts(const HeightmapLayout& a, const HeightmapLayout& b) {
+    HeightmapLayout layout;
+    layout.center_row = max(a.center_row, b.center_row);
+    layout.center_col = max(a.center_col, b.center_col);
+    int lowest = min(a.center_row - a.n_rows + 1, b.center_row - b.n_rows + 1);
+    int rightmost = max(a.n_cols - 1 - a.center_col, b.n_cols - 1 - b.center_col);
+    layout.n_rows = layout.center_row - lowest + 1;
+    layout.n_cols = layout.center_col + rightmost + 1;
+    return layout;
+}
+
+/**
+ * @brief Compares two heightmaps over the cells written in both.
+ *
+ * Only the tiles of map2 that map1 also has are visited.
+ *
+ * @param map1 The first heightmap.
+ * @param map2 The second heightmap, usually the smaller one.
+ * @param percentile The fraction of the overlapping cells for the percentile error.
+ * @return SimilarityStats The statistics of the differences.
+ */
+SimilarityStats compare_heightmaps(const TiledHeightmap& map1, const TiledHeightmap& map2, double percentile) {
+    SimilarityAccumulator accumulator;
+    for (const TiledHeightmap::Tile& tile : map2.get_tiles()) {
+        const int* other = map1.find_tile(tile.tx, tile.ty);
+        if (other) {
+            accumulator.add(other, tile.cells.data(), HEIGHTMAP_TILE * HEIGHTMAP_TILE);
+        }
+    }
+    return accumulator.finish(percentile);
+}
+
+/**
+ * @brief Merges the heightmap of an image into the combined heightmap, if they agree enough.
+ *
+ * The overlap is measured once, then the image is merged tile by tile in place, so its
+ * points are never binned again. The first image (empty combined heightmap) is always merged.
+ * With registration enabled the pose of the image is refined first (see register_heightmap()),
+ * and the corrected heightmap is merged instead of the image when it agrees better with the
+ * combined one. It then replaces the image, a rejected image is left as binned. The correction
+ * only affects the heightmaps: the pose and the points of the image are not updated, so every
+ * merge (including those of retake) registers the image again.
+ * With fusion enabled the image is always merged: the thresholds are only reported, and the
+ * cells that disagree are left out of the fused layers by the gate of TiledHeightmap::merge().
+ *
+ * @param combined The combined heightmap.
+ * @param image The heightmap of the image, replaced by its corrected version if it is merged.
+ * @param thresholds When the overlap is good enough to merge, see similarity_accepts().
+ * @param registration If not null, the settings of the pose refinement.
+ * @param fusion If not null, the settings of the fusion.
+ * @param stats If not null, receives the statistics of the overlap.
+ * @return true if the image was merged.
+ */
+bool merge_heightmap(TiledHeightmap& combined, TiledHeightmap& image, const SimilarityThresholds& thresholds,
+                     const RegistrationOptions* registration, const FusionOptions* fusion, SimilarityStats* stats) {
+    bool fuse = fusion && fusion->enabled;
+    if (!combined.empty()) {
+        SimilarityStats overlap = compare_heightmaps(combined, image, thresholds.percentile);
+        // The corrected heightmap only replaces the image once it is merged
+        TiledHeightmap corrected(image.get_cell_dim());
+        bool use_corrected = false;
+        if (registration && registration->enabled) {
+            Registration pose;
+            if (register_heightmap(combined, image, *registration, pose, corrected)) {
+                SimilarityStats corrected_overlap = compare_heightmaps(combined, corrected, thresholds.percentile);
+                if (corrected_overlap.n >= thresholds.min_overlap && corrected_overlap.rmse < overlap.rmse) {
+                    #if DEBUG
+                    printf("Pose corrected by %.1f mm, %.1f mm, %.2f deg (RMSE %.1f -> %.1f mm)\n",
+                           pose.dx, pose.dy, pose.yaw, overlap.rmse, corrected_overlap.rmse);
+                    #endif
+                    use_corrected = true;
+                    overlap = corrected_overlap;
+                }
+            }
+        }
+        if (stats) {
+            *stats = overlap;
+        }
+        if (!similarity_accepts(overlap, thresholds) && !fuse) {
+            return false;
+        }
+        if (use_corrected) {
+            image = std::move(corrected);
+        }
+    }
+    #if DEBUG
+    uint64_t n_gated = combined.merge(image, fuse ? fusion->gate : 0.0f);
+    if (n_gated > 0) {
+        printf("%llu cells outside of the fusion gate\n", (unsigned long long)n_gated);
+    }
+    #else
+    combined.merge(image, fuse ? fusion->gate : 0.0f);
+    #endif
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef HEIGHTMAP_H
+#define HEIGHTMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <opencv2/opencv.hpp>
+#include "point_cloud.h"
+#include "similarity.h"
+
+// Tiles are HEIGHTMAP_TILE x HEIGHTMAP_TILE cells
+#define HEIGHTMAP_TILE_BITS 6
+#define HEIGHTMAP_TILE (1 << HEIGHTMAP_TILE_BITS)
+// Fewest points given to each thread when binning in parallel
+#define HEIGHTMAP_MIN_SHARD_POINTS 16384
+
+/**
+ * @brief Placement of a heightmap in a dense matrix.
+ *
+ * Cell (cx, cy) is at row center_row - cy and column center_col + cx, like in the
+ * text dumps written by save_matrix_with_zeros().
+ */
+struct HeightmapLayout {
+    int n_rows = 1;
+    int n_cols = 1;
+    int center_row = 0;
+    int center_col = 0;
+};
+
+// Per cell statistics kept by a TiledHeightmap
+enum HeightmapLayer {
+    HEIGHTMAP_MAX,       // Highest z (CV_32SC1)
+    HEIGHTMAP_MIN,       // Lowest z (CV_32SC1)
+    HEIGHTMAP_MEAN,      // Mean z (CV_32FC1)
+    HEIGHTMAP_COUNT,     // Number of points (CV_32SC1)
+    HEIGHTMAP_VARIANCE,  // Variance of z (CV_32FC1)
+    HEIGHTMAP_FUSED,           // Inverse variance weighted z, from the points given a weight (CV_32FC1)
+    HEIGHTMAP_FUSED_VARIANCE,  // Variance of the fused z (CV_32FC1)
+    // Raw accumulators, to restore a heightmap exactly (see read_heightmap_state())
+    HEIGHTMAP_M2,          // Sum of the squared differences from the mean (CV_32FC1)
+    HEIGHTMAP_WEIGHT,      // Sum of the weights (CV_32FC1)
+    HEIGHTMAP_WEIGHTED_Z   // Sum of the weighted z (CV_32FC1)
+};
+
+/**
+ * @brief Heightmap made of fixed-size tiles allocated on first touch.
+ *
+ * Cell (cx, cy) covers the world points with floor(x / cell_dim) == cx and
+ * floor(y / cell_dim) == cy, with no bounds: the map grows with the observed area. Each cell
+ * keeps the highest z of its points, 0 is an empty cell, along with the lowest z, the number
+ * of points and the running mean and variance of z. Points binned with a weight (the inverse
+ * of their noise variance) are also fused in information form: the sum of the weights and of
+ * the weighted z, from which the fused z and its variance are read. Every statistic is stored
+ * in its own array (one layer), so a layer can be scanned without loading the others.
+ */
+class TiledHeightmap {
+public:
+    // Layers of HEIGHTMAP_TILE rows of HEIGHTMAP_TILE cells, row y = cy - ty * HEIGHTMAP_TILE
+    struct Tile {
+        int tx;
+        int ty;
+        std::vector<int> cells;       // Highest z, 0 if the cell is empty
+        std::vector<int> min_z;       // Lowest z, 0 if the cell is empty
+        std::vector<uint32_t> count;  // Number of points
+        std::vector<float> mean;      // Mean z
+        std::vector<float> m2;        // Sum of the squared differences from the mean
+        std::vector<float> weight;    // Sum of the weights (1 / mm^2)
+        std::vector<float> weighted_z;  // Sum of the weighted z
+    };
+
+    explicit TiledHeightmap(int cell_dim);
+
+    int get_cell_dim() const { return cell_dim; }
+    int cell_x(float x) const { return static_cast<int>(std::floor(static_cast<double>(x) / cell_dim)); }
+    int cell_y(float y) const { return static_cast<int>(std::floor(static_cast<double>(y) / cell_dim)); }
+
+    void add_point(float x, float y, float z, float weight = 0.0f);
+    void add_cell(int cx, int cy, int z_value, float weight = 0.0f);
+    void add_cell(int cx, int cy, const Tile& source, int source_index);
+    void add_points(const float* xs, const float* ys, const float* zs, size_t n_points, int n_workers = 0, const float* weights = nullptr);
+    void add_points(const PointCloud& points, int n_workers = 0, const float* weights = nullptr);
+    uint64_t merge(const TiledHeightmap& other, float fusion_gate = 0.0f);
+    int get(int cx, int cy) const;
+    int* find_tile(int tx, int ty);
+    const int* find_tile(int tx, int ty) const;
+    int* get_tile(int tx, int ty);
+    void set_tile_layer(int tx, int ty, HeightmapLayer layer, const void* values);
+
+    const std::vector<Tile>& get_tiles() const { return tiles; }
+    bool empty() const { return tiles.empty(); }
+    size_t memory_bytes() const { return tiles.size() * HEIGHTMAP_TILE * HEIGHTMAP_TILE * (2 * sizeof(int) + sizeof(uint32_t) + 4 * sizeof(float)); }
+    bool bounds(int& min_cx, int& min_cy, int& max_cx, int& max_cy) const;
+    HeightmapLayout layout() const;
+    void to_mat(const HeightmapLayout& layout, cv::Mat& matrix, HeightmapLayer layer = HEIGHTMAP_MAX) const;
+
+private:
+    size_t get_tile_index(int tx, int ty);
+    size_t touch_cell(int cx, int cy);
+    static uint64_t tile_key(int tx, int ty) { return ((uint64_t)(uint32_t)tx << 32) | (uint32_t)ty; }
+
+    int cell_dim;
+    std::vector<Tile> tiles;
+    std::unordered_map<uint64_t, size_t> tile_index;
+    // Last tile touched by add_cell(), neighbouring points usually share it
+    uint64_t last_key;
+    size_t last_tile;
+    int min_cx, min_cy, max_cx, max_cy;
+};
+
+// Tile of a cell, rounding towards minus infinity
+inline int heightmap_tile_of(int c) { return c >= 0 ? c >> HEIGHTMAP_TILE_BITS : ~((~c) >> HEIGHTMAP_TILE_BITS); }
+
+const char* heightmap_layer_name(HeightmapLayer layer);
+int heightmap_layer_type(HeightmapLayer layer);
+void heightmap_tile_layer(const TiledHeightmap::Tile& tile, HeightmapLayer layer, void* values);
+HeightmapLayout merge_layouts(const HeightmapLayout& a, const HeightmapLayout& b);
+SimilarityStats compare_heightmaps(const TiledHeightmap& map1, const TiledHeightmap& map2, double percentile = 0.95);
+struct RegistrationOptions;
+struct FusionOptions;
+bool merge_heightmap(TiledHeightmap& combined, TiledHeightmap& image, const SimilarityThresholds& thresholds,
+                     const RegistrationOptions* registration = nullptr, const FusionOptions* fusion = nullptr,
+                     SimilarityStats* stats = nullptr);
+
+#endif // HEIGHTMAP_H
@@ -0,0 +1,326 @@
+#include "resources.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Checks whether any cell of a tile is written
+static bool tile_written(const TiledHeightmap::Tile& tile) {
+    for (int i = 0; i < HEIGHTMAP_TILE * HEIGHTMAP_TILE; ++i) {
+        if (tile.count[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Writes layers of a heightmap in the binary heightmap file format to a stream.
+ *
+ * The tiled encoding only stores the tiles holding a written cell, so the size of the file
+ * follows the observed area instead of its bounding box.
+ *
+ * @param file The stream, opened in binary mode.
+ * @param heightmap The heightmap.
+ * @param layout The dense layout, stored in the header and used by the dense encoding.
+ * @param layers The layers to store, at most HEIGHTMAP_FILE_MAX_LAYERS.
+ * @param encoding How the cells are stored.
+ * @param camera_position The camera position of the heightmap.
+ * @param camera_angle The camera angle of the heightmap.
+ * @return true if the heightmap was written.
+ */
+bool write_heightmap_file(ostream& file, const TiledHeightmap& heightmap, const HeightmapLayout& layout,
+                          const vector<HeightmapLayer>& layers, HeightmapEncoding encoding, const float camera_position[3],
+                          const float camera_angle[3]) {
+    if (layers.empty() || layers.size() > HEIGHTMAP_FILE_MAX_LAYERS) {
+        cerr << "Invalid number of heightmap layers" << endl;
+        return false;
+    }
+    vector<const TiledHeightmap::Tile*> tiles;
+    if (encoding == HEIGHTMAP_TILED) {
+        for (const TiledHeightmap::Tile& tile : heightmap.get_tiles()) {
+            if (tile_written(tile)) {
+                tiles.push_back(&tile);
+            }
+        }
+    }
+
+    HeightmapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HEIGHTMAP_FILE_MAGIC, 4);
+    header.version = HEIGHTMAP_FILE_VERSION;
+    header.encoding = encoding;
+    header.n_layers = layers.size();
+    header.cell_dim = heightmap.get_cell_dim();
+    header.n_rows = layout.n_rows;
+    header.n_cols = layout.n_cols;
+    header.center_row = layout.center_row;
+    header.center_col = layout.center_col;
+    header.tile_size = HEIGHTMAP_TILE;
+    header.n_tiles = tiles.size();
+    for (int i = 0; i < 3; i++) {
+        header.camera_position[i] = camera_position[i];
+        header.camera_angle[i] = camera_angle[i];
+    }
+    for (size_t k = 0; k < layers.size(); k++) {
+        header.layers[k] = layers[k];
+        header.layer_types[k] = heightmap_layer_type(layers[k]);
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (encoding == HEIGHTMAP_TILED) {
+        vector<int32_t> coordinates;
+        for (const TiledHeightmap::Tile* tile : tiles) {
+            coordinates.push_back(tile->tx);
+            coordinates.push_back(tile->ty);
+        }
+        file.write(reinterpret_cast<const char*>(coordinates.data()), coordinates.size() * sizeof(int32_t));
+        vector<uint32_t> values(HEIGHTMAP_TILE * HEIGHTMAP_TILE);
+        for (HeightmapLayer layer : layers) {
+            for (const TiledHeightmap::Tile* tile : tiles) {
+                heightmap_tile_layer(*tile, layer, values.data());
+                file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(uint32_t));
+            }
+        }
+    } else {
+        Mat matrix;
+        for (HeightmapLayer layer : layers) {
+            heightmap.to_mat(layout, matrix, layer);
+            for (int row = 0; row < matrix.rows; row++) {
+                file.write(reinterpret_cast<const char*>(matrix.ptr<uint32_t>(row)), matrix.cols * sizeof(uint32_t));
+            }
+        }
+    }
+    return file.good();
+}
+
+/**
+ * @brief Writes layers of a heightmap to a binary heightmap file.
+ *
+ * @param filename The file to write.
+ * @return true if the file was written.
+ *
+ * The other parameters are those of write_heightmap_file(ostream&, ...).
+ */
+bool write_heightmap_file(const char filename[], const TiledHeightmap& heightmap, const HeightmapLayout& layout,
+                          const vector<HeightmapLayer>& layers, HeightmapEncoding encoding, const float camera_position[3],
+                          const float camera_angle[3]) {
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    return write_heightmap_file(file, heightmap, layout, layers, encoding, camera_position, camera_angle);
+}
+
+/**
+ * @brief Maps a binary heightmap file in memory and validates its header.
+ *
+ * @param filename The file to map.
+ * @return true if the file was mapped and is a valid heightmap file.
+ */
+bool MappedHeightmapFile::open(const char filename[]) {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(HeightmapFileHeader)) {
+        cerr << "Invalid heightmap file " << filename << endl;
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        cerr << "Error mapping file " << filename << endl;
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+    length = st.st_size;
+    owned = true;
+    if (!valid()) {
+        cerr << "Invalid heightmap file " << filename << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Uses heightmap file data already in memory, such as a record of a mapped session file.
+ *
+ * The data is not copied and must outlive the object.
+ *
+ * @param data The heightmap file data.
+ * @param length The length of the data in bytes.
+ * @return true if the data is a valid heightmap file.
+ */
+bool MappedHeightmapFile::view(const void* data, size_t length) {
+    close();
+    this->data = static_cast<const uint8_t*>(data);
+    this->length = length;
+    owned = false;
+    if (length < sizeof(HeightmapFileHeader) || !valid()) {
+        cerr << "Invalid heightmap data" << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedHeightmapFile::valid() const {
+    const HeightmapFileHeader& h = header();
+    bool valid = memcmp(h.magic, HEIGHTMAP_FILE_MAGIC, 4) == 0 && h.version == HEIGHTMAP_FILE_VERSION &&
+                 h.encoding <= HEIGHTMAP_TILED && h.n_layers >= 1 && h.n_layers <= HEIGHTMAP_FILE_MAX_LAYERS &&
+                 h.n_rows > 0 && h.n_cols > 0;
+    if (!valid) {
+        return false;
+    }
+    // The sizes come from the file, they are checked by dividing the length so they cannot overflow
+    uint64_t available = length - sizeof(HeightmapFileHeader);
+    if (h.encoding == HEIGHTMAP_TILED) {
+        uint64_t tile_bytes = 2 * sizeof(int32_t) + (uint64_t)h.n_layers * HEIGHTMAP_TILE * HEIGHTMAP_TILE * sizeof(uint32_t);
+        return h.tile_size == HEIGHTMAP_TILE && h.n_tiles <= available / tile_bytes;
+    }
+    return (uint64_t)h.n_rows * h.n_cols <= available / (h.n_layers * sizeof(uint32_t));
+}
+
+void MappedHeightmapFile::close() {
+    if (data) {
+        if (owned) {
+            munmap(const_cast<uint8_t*>(data), length);
+        }
+        data = nullptr;
+        length = 0;
+    }
+}
+
+HeightmapLayout MappedHeightmapFile::layout() const {
+    HeightmapLayout layout;
+    layout.n_rows = header().n_rows;
+    layout.n_cols = header().n_cols;
+    layout.center_row = header().center_row;
+    layout.center_col = header().center_col;
+    return layout;
+}
+
+/**
+ * @brief Returns the index of a layer in the file, -1 if it is not stored.
+ */
+int MappedHeightmapFile::find_layer(HeightmapLayer layer) const {
+    for (uint32_t k = 0; k < header().n_layers; k++) {
+        if (header().layers[k] == (uint32_t)layer) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// Number of values of each layer
+size_t MappedHeightmapFile::layer_values() const {
+    const HeightmapFileHeader& h = header();
+    if (h.encoding == HEIGHTMAP_TILED) {
+        return h.n_tiles * h.tile_size * h.tile_size;
+    }
+    return (size_t)h.n_rows * h.n_cols;
+}
+
+const void* MappedHeightmapFile::layer_data(int k) const {
+    const uint8_t* first = data + sizeof(HeightmapFileHeader);
+    if (header().encoding == HEIGHTMAP_TILED) {
+        first += header().n_tiles * 2 * sizeof(int32_t);
+    }
+    return first + k * layer_values() * sizeof(uint32_t);
+}
+
+/**
+ * @brief Renders a layer of the file into a dense matrix of the stored layout.
+ *
+ * @param k The index of the layer.
+ * @param matrix Receives the layer (n_rows x n_cols, CV_32SC1 or CV_32FC1).
+ */
+void MappedHeightmapFile::to_mat(int k, Mat& matrix) const {
+    const HeightmapFileHeader& h = header();
+    const uint32_t* values = static_cast<const uint32_t*>(layer_data(k));
+    matrix = Mat::zeros(h.n_rows, h.n_cols, h.layer_types[k]);
+    if (h.encoding == HEIGHTMAP_DENSE) {
+        for (int row = 0; row < h.n_rows; row++) {
+            memcpy(matrix.ptr<uint32_t>(row), values + (size_t)row * h.n_cols, h.n_cols * sizeof(uint32_t));
+        }
+        return;
+    }
+    const int32_t* coordinates = tile_coordinates();
+    int tile = h.tile_size;
+    for (uint64_t t = 0; t < h.n_tiles; t++) {
+        int col0 = h.center_col + coordinates[2 * t] * tile;
+        int first = max(0, -col0);
+        int last = min(tile, h.n_cols - col0);
+        if (first >= last) {
+            continue;
+        }
+        const uint32_t* tile_values = values + t * tile * tile;
+        for (int y = 0; y < tile; y++) {
+            int row = h.center_row - (coordinates[2 * t + 1] * tile + y);
+            if (row < 0 || row >= h.n_rows) {
+                continue;
+            }
+            memcpy(matrix.ptr<uint32_t>(row) + col0 + first, tile_values + y * tile + first, (last - first) * sizeof(uint32_t));
+        }
+    }
+    return;
+}
+
+// Layers written by write_heightmap_state(), all of them are needed by read_heightmap_state()
+static const vector<HeightmapLayer> state_layers = { HEIGHTMAP_MAX, HEIGHTMAP_MIN, HEIGHTMAP_MEAN, HEIGHTMAP_COUNT,
+                                                     HEIGHTMAP_M2, HEIGHTMAP_WEIGHT, HEIGHTMAP_WEIGHTED_Z };
+
+/**
+ * @brief Writes every layer kept by the tiles of a heightmap, so it can be restored exactly.
+ *
+ * The mean and variance of merged images depend on the raw accumulators (count, mean and sum
+ * of the squared differences, sum of the weights and of the weighted z), which are stored
+ * instead of the variances derived from them.
+ *
+ * @param file The stream, opened in binary mode.
+ * @param heightmap The heightmap.
+ * @param camera_position The camera position of the heightmap.
+ * @param camera_angle The camera angle of the heightmap.
+ * @return true if the heightmap was written.
+ */
+bool write_heightmap_state(ostream& file, const TiledHeightmap& heightmap, const float camera_position[3], const float camera_angle[3]) {
+    return write_heightmap_file(file, heightmap, heightmap.layout(), state_layers, HEIGHTMAP_TILED, camera_position, camera_angle);
+}
+
+/**
+ * @brief Restores a heightmap written by write_heightmap_state().
+ *
+ * @param file The heightmap file.
+ * @param heightmap An empty heightmap of the cell dimension of the file, receives the cells.
+ * @return true if the file holds the state of a heightmap of this cell dimension.
+ */
+bool read_heightmap_state(const MappedHeightmapFile& file, TiledHeightmap& heightmap) {
+    const HeightmapFileHeader& h = file.header();
+    if (h.encoding != HEIGHTMAP_TILED || h.cell_dim != heightmap.get_cell_dim()) {
+        return false;
+    }
+    vector<int> indices;
+    for (HeightmapLayer layer : state_layers) {
+        int k = file.find_layer(layer);
+        if (k < 0) {
+            return false;
+        }
+        indices.push_back(k);
+    }
+    const int32_t* coordinates = file.tile_coordinates();
+    size_t tile_values = (size_t)h.tile_size * h.tile_size;
+    for (size_t l = 0; l < state_layers.size(); l++) {
+        const uint32_t* values = static_cast<const uint32_t*>(file.layer_data(indices[l]));
+        for (uint64_t t = 0; t < h.n_tiles; t++) {
+            heightmap.set_tile_layer(coordinates[2 * t], coordinates[2 * t + 1], state_layers[l], values + t * tile_values);
+        }
+    }
+    return true;
+}
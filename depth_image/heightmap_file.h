@@ -0,0 +1,98 @@
+#ifndef HEIGHTMAP_FILE_H
+#define HEIGHTMAP_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "heightmap.h"
+
+#define HEIGHTMAP_FILE_MAGIC "DHMP"
+#define HEIGHTMAP_FILE_VERSION 2
+// Most layers stored in a heightmap file
+#define HEIGHTMAP_FILE_MAX_LAYERS 8
+
+// How the cells are stored in a heightmap file
+enum HeightmapEncoding : uint32_t {
+    HEIGHTMAP_DENSE = 0,  // Each layer is n_rows x n_cols values, row-major
+    HEIGHTMAP_TILED = 1   // Only the tiles holding a written cell, see HeightmapFileHeader
+};
+
+/**
+ * @brief Header of a binary heightmap file.
+ *
+ * All values are little-endian and 4 bytes wide (int32_t or float, see layer_types). The
+ * header is 144 bytes long, so the layers are aligned and can be used in place when the file
+ * is memory mapped.
+ *
+ * A dense file is followed by n_layers layers of n_rows x n_cols values, laid out like the
+ * text dumps: cell (cx, cy) is at row center_row - cy and column center_col + cx.
+ *
+ * A tiled file is followed by n_tiles (tx, ty) int32_t pairs, then by n_layers layers of
+ * n_tiles tiles of tile_size x tile_size values. Tile (tx, ty) holds the cells
+ * cx = tx * tile_size + x and cy = ty * tile_size + y, row y first.
+ */
+struct HeightmapFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t encoding;
+    uint32_t n_layers;
+    int32_t cell_dim;
+    int32_t n_rows;
+    int32_t n_cols;
+    int32_t center_row;
+    int32_t center_col;
+    uint32_t tile_size;
+    uint64_t n_tiles;
+    float camera_position[3];
+    float camera_angle[3];
+    uint32_t layers[HEIGHTMAP_FILE_MAX_LAYERS];       // HeightmapLayer of each layer
+    uint32_t layer_types[HEIGHTMAP_FILE_MAX_LAYERS];  // CV_32SC1 or CV_32FC1
+    uint8_t reserved[8];
+};
+static_assert(sizeof(HeightmapFileHeader) == 144, "HeightmapFileHeader must be 144 bytes");
+
+bool write_heightmap_file(std::ostream& file, const TiledHeightmap& heightmap, const HeightmapLayout& layout,
+                          const std::vector<HeightmapLayer>& layers, HeightmapEncoding encoding, const float camera_position[3],
+                          const float camera_angle[3]);
+bool write_heightmap_file(const char filename[], const TiledHeightmap& heightmap, const HeightmapLayout& layout,
+                          const std::vector<HeightmapLayer>& layers, HeightmapEncoding encoding, const float camera_position[3],
+                          const float camera_angle[3]);
+bool write_heightmap_state(std::ostream& file, const TiledHeightmap& heightmap, const float camera_position[3], const float camera_angle[3]);
+
+/**
+ * @brief Read-only memory mapping of a binary heightmap file, or view of heightmap file data in memory.
+ */
+class MappedHeightmapFile {
+public:
+    MappedHeightmapFile() : data(nullptr), length(0), owned(false) {}
+    ~MappedHeightmapFile() { close(); }
+    MappedHeightmapFile(const MappedHeightmapFile&) = delete;
+    MappedHeightmapFile& operator=(const MappedHeightmapFile&) = delete;
+
+    bool open(const char filename[]);
+    bool view(const void* data, size_t length);
+    void close();
+
+    const HeightmapFileHeader& header() const { return *reinterpret_cast<const HeightmapFileHeader*>(data); }
+    HeightmapLayout layout() const;
+    int find_layer(HeightmapLayer layer) const;
+    // Tile coordinates of a tiled file, (tx, ty) pairs
+    const int32_t* tile_coordinates() const { return reinterpret_cast<const int32_t*>(data + sizeof(HeightmapFileHeader)); }
+    // Values of layer k: n_rows x n_cols for a dense file, n_tiles tiles for a tiled one
+    const void* layer_data(int k) const;
+    void to_mat(int k, cv::Mat& matrix) const;
+
+private:
+    bool valid() const;
+    size_t layer_values() const;
+
+    const uint8_t* data;
+    size_t length;
+    bool owned;  // Whether data is a mapping to unmap on close()
+};
+
+bool read_heightmap_state(const MappedHeightmapFile& file, TiledHeightmap& heightmap);
+
+#endif // HEIGHTMAP_FILE_H
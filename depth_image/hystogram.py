@@ -1,19 +1,55 @@
 import numpy as np
 import matplotlib.pyplot as plt
 import os
+import struct
 
 execution_path = os.path.dirname(os.path.abspath(__file__))
 
-
-
-# file_path = os.path.join(execution_path, 'data', f'deprojected_points2.txt')
-file_path = os.path.join(execution_path, 'data', f'combinated_deprojected_points.txt')
+# Layers of a heightmap file (HeightmapLayer in heightmap.h)
+HEIGHTMAP_MAX = 0
+HEIGHTMAP_FUSED = 5
+CV_32S = 4
+# HeightmapFileHeader in heightmap_file.h
+HEIGHTMAP_FILE_VERSION = 2
+HEIGHTMAP_HEADER_SIZE = 144
+
+
+def load_heightmap_values(path):
+    """Returns the cells of a binary heightmap file (see heightmap_file.h), memory mapped.
+
+    The fused heights are used when the file has them, otherwise the highest z of each cell.
+    Tiled files are not rendered into a grid: the histogram only needs the values.
+    """
+    with open(path, 'rb') as f:
+        header = f.read(HEIGHTMAP_HEADER_SIZE)
+    magic, version, encoding, n_layers, cell_dim, n_rows, n_cols, center_row, center_col, tile_size, n_tiles = \
+        struct.unpack_from('<4sIIIiiiiiIQ', header)
+    if magic != b'DHMP' or version != HEIGHTMAP_FILE_VERSION:
+        raise ValueError(f'{path} is not a version {HEIGHTMAP_FILE_VERSION} heightmap file')
+    layers = struct.unpack_from('<8I', header, 72)[:n_layers]
+    layer_types = struct.unpack_from('<8I', header, 104)[:n_layers]
+    k = layers.index(HEIGHTMAP_FUSED) if HEIGHTMAP_FUSED in layers else layers.index(HEIGHTMAP_MAX)
+    if encoding == 1:
+        n_values = n_tiles * tile_size * tile_size
+        offset = HEIGHTMAP_HEADER_SIZE + n_tiles * 8
+    else:
+        n_values = n_rows * n_cols
+        offset = HEIGHTMAP_HEADER_SIZE
+    dtype = np.int32 if layer_types[k] == CV_32S else np.float32
+    return np.memmap(path, dtype=dtype, mode='r', offset=offset + k * n_values * 4, shape=(n_values,))
+
+
+# file_path = os.path.join(execution_path, 'data', f'heightmap_image2.dhm')
+file_path = os.path.join(execution_path, 'data', f'combinated_heightmap.dhm')
 output_path = os.path.join(execution_path, 'data', f'histogram.png')
 
-
-matrix = np.loadtxt(file_path, delimiter=',', skiprows=1)
-# # Flatten the matrix to get the values
-values = matrix.flatten()
+if os.path.exists(file_path):
+    values = load_heightmap_values(file_path)
+else:
+    # Text dump written with --export-text
+    matrix = np.loadtxt(os.path.join(execution_path, 'data', f'combinated_deprojected_points.txt'), delimiter=',', skiprows=1)
+    # # Flatten the matrix to get the values
+    values = matrix.flatten()
 
 # # Create a histogram of the values
 # Filter out the zero values
@@ -23,4 +59,4 @@ plt.hist(non_zero_values, bins=50, edgecolor='black')
 plt.title('Histogram of Non-Zero Matrix Values')
 plt.xlabel('Value (mm)')
 plt.ylabel('Frequency')
-plt.savefig(output_path)
\ No newline at end of file
+plt.savefig(output_path)
@@ -8,8 +8,8 @@
 
 // Main function
 int main(int argc, char *argv[]) {
-    if (argc != 6) {
-        printf("Usage: %s <number of images that are going to be computed> <minimum distance(mm)> <maximum distance(mm)> <number of frames> <cell discretization(mm)>\n", argv[0]);
+    if (argc < 6) {
+        printf("Usage: %s <number of images that are going to be computed> <minimum distance(mm)> <maximum distance(mm)> <number of frames> <cell discretization(mm)> [--source=<file.bag|raw Z16 dump>] [--workers=<n>] [--ring=<frames>] [--estimator=<mean|median|trimmed|mode>] [--adaptive=<stderr(mm)>[,<fraction>]] [--min-frames=<n>] [--merge-rmse=<mm>] [--merge-mad=<mm>] [--merge-percentile=<mm>[,<fraction>]] [--merge-min-overlap=<cells>] [--register[=<search(mm)>[,<max yaw(deg)>]]] [--traversability[=<max slope(deg)>[,<max step(mm)>[,<max roughness(mm)>]]]] [--fuse[=<gate(std devs)>]] [--export=<artifact>[,<artifact>...]] [--histogram] [--export-text]\n", argv[0]);
         return EXIT_FAILURE;
     }
     int n_images = atoi(argv[1]);
@@ -21,27 +21,35 @@ int main(int argc, char *argv[]) {
     double maxAbsX=0;
     double maxAbsY=0;
 
-    int center_x;
-    int center_y;
-
-    system("rm ../data/*");
+    // The session file holds the records of every image for retake, it replaces the one of the previous session
+    SessionFileHeader session_header;
+    memset(&session_header, 0, sizeof(session_header));
+    session_header.min_dist = min_dist;
+    session_header.max_dist = max_dist;
+    session_header.n_frames = n_index;
+    session_header.cell_dim = cell_dim;
+    SessionWriter session;
+    if (!session.create("../data/session.dss", session_header)) {
+        return EXIT_FAILURE;
+    }
 
-    vector<string> filenames;
+    // Heightmap and camera pose of each image, and the combined heightmap
+    vector<TiledHeightmap> image_heightmaps;
+    vector<Vector3f> camera_positions;
+    vector<Vector3f> camera_angles;
+    TiledHeightmap big_heightmap_combined(cell_dim);
+    ExportOptions exports = get_export_options(argc, argv, 6);
 
-    // Initialize RealSense pipeline
-    pipeline pipeline;
-    config config;
-    config.enable_stream(RS2_STREAM_DEPTH, WIDTH, HEIGHT, RS2_FORMAT_Z16, FPS);
-    pipeline.start(config);
-    device dev = pipeline.get_active_profile().get_device();
-    if (!dev) {
-        printf("No device found.\n");
+    // Initialize the frame source (RealSense camera, .bag recording or raw dump)
+    unique_ptr<FrameSource> source = open_frame_source(get_option(argc, argv, 6, "source"));
+    if (!source) {
         return EXIT_FAILURE;
-    } else {
-        #if DEBUG
-        printf("Device found.\n");
-        #endif
     }
+    CaptureOptions capture_options = get_capture_options(argc, argv, 6);
+    SimilarityThresholds merge_thresholds = get_similarity_thresholds(argc, argv, 6);
+    RegistrationOptions registration = get_registration_options(argc, argv, 6);
+    TraversabilityOptions traversability = get_traversability_options(argc, argv, 6);
+    FusionOptions fusion = get_fusion_options(argc, argv, 6);
 
     // Get depth intrinsics
     rs2_intrinsics intrinsics;
@@ -58,83 +66,141 @@ int main(int argc, char *argv[]) {
 
     
     for (int image_n = 0; image_n < n_images; image_n++) {
-        // Reinitialize OpenCV matrices to accumulate depth data
-        Mat accumulated_depth = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
-        Mat valid_pixel_count = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
+        // Per-pixel statistics of the frames of this image
+        DepthAccumulator accumulator(min_dist, max_dist, capture_options.estimator);
         
-        intrinsics = get_main_frames_count(pipeline, n_index, accumulated_depth, valid_pixel_count, min_dist, max_dist);
+        intrinsics = get_main_frames_count(*source, n_index, accumulator, capture_options);
         //aqui va too       
 
         char i_filename[100];
         sprintf(i_filename, "../data/camera_points_image%d.txt", image_n);
         char o_filename[100];
-        sprintf(o_filename, "../data/reference_points_image%d.txt", image_n);
-        filenames.push_back(o_filename);
+        sprintf(o_filename, "../data/reference_points_image%d.bin", image_n);
         char pos_filename[100];
         sprintf(pos_filename, "../position_camera.txt");
-        write_data_to_files(n_index, image_n, i_filename, o_filename, pos_filename, accumulated_depth, valid_pixel_count, intrinsics, min_dist, max_dist, maxAbsX, maxAbsY);
+        Vector3f camera_position, camera_angle;
+        PointCloud points;
+        write_data_to_files(n_index, image_n, i_filename, o_filename, pos_filename, accumulator, intrinsics, maxAbsX, maxAbsY, camera_position, camera_angle,
+                            exports, points, &session);
+        camera_positions.push_back(camera_position);
+        camera_angles.push_back(camera_angle);
+
+        // Bin the image once and merge it into the combined heightmap as soon as it arrives
+        image_heightmaps.emplace_back(cell_dim);
+        vector<float> weights;
+        if (fusion.enabled) {
+            fusion.noise.point_weights(points, camera_position, weights);
+        }
+        image_heightmaps.back().add_points(points, capture_options.n_workers, fusion.enabled ? weights.data() : nullptr);
+        // Cache the grid as binned, before the registration can move it, so retake does not bin the image again
+        auto grid = make_shared<const TiledHeightmap>(image_heightmaps.back());
+        const NoiseModel* noise = fusion.enabled ? &fusion.noise : nullptr;
+        output_writer().submit([&session, grid, image_n, camera_position, camera_angle, noise]() {
+            append_session_grid(session, image_n, *grid, camera_position, camera_angle, noise);
+        });
+        if (!merge_heightmap(big_heightmap_combined, image_heightmaps.back(), merge_thresholds, &registration, &fusion)) {
+            cout << "Images too diferent to be merged" << endl;
+        } else if (image_n > 0) {
+            cout << "Image " << image_n << " merged" << endl;
+        }
         
         // Wait for a keyboard input
-        if (image_n != n_images-1) {
+        if (image_n != n_images-1 && source->is_live()) {
             printf("Image %d done.\nPress any key to continue...\n", image_n);
             getchar();
         } else {
             printf("Image %d done.\n", image_n);
         }
     }
-    // Stop the pipeline
-    pipeline.stop();
-    
-    int num_rows = (ceil((maxAbsY) / cell_dim))+1;
-    int num_cols = (ceil((2 * maxAbsX) / cell_dim))+1;
-    
-    center_y = num_rows;
-    center_x = num_cols / 2;
-
-    int e = 20;
-    cout << "Num Cols: " << num_cols << endl;
-    cout << "Num Rows: " << num_rows << endl;
-
-    Vector3f o_camera_position;
-    Mat big_matrix_combined = Mat::zeros(num_rows, num_cols, CV_32SC1);
-    o_camera_position = populate_matrix_from_file(filenames[0].c_str(), big_matrix_combined, center_y, center_x, cell_dim, num_rows, num_cols);
-
-    Mat output;
-    Mat big_matrix_combined1_photo = big_matrix_combined.clone();
-    save_matrix_with_zeros(big_matrix_combined1_photo, "../data/deprojected_points0.txt", num_rows, num_cols, o_camera_position);
-    normalizeAndInvert(big_matrix_combined1_photo, output);
-    imwrite("../data/deprojected_image0.png", output);
+    // Stop the frame source and wait for the files of the images
+    source->stop();
+    output_writer().flush();
+    #if DEBUG
+    printf("Output writer stalls: %llu\n", (unsigned long long)output_writer().get_stalls());
+    #endif
     
+    if (n_images == 1) {
+        cout << "Only one image" << endl;
+    }
+
+    // The dense outputs of all the images share the layout of the observed area
+    HeightmapLayout layout = big_heightmap_combined.layout();
+    for (const TiledHeightmap& heightmap : image_heightmaps) {
+        layout = merge_layouts(layout, heightmap.layout());
+    }
+    cout << "Num Cols: " << layout.n_cols << endl;
+    cout << "Num Rows: " << layout.n_rows << endl;
+
+    // Layers of the heightmap files
+    vector<HeightmapLayer> layers = { HEIGHTMAP_MAX, HEIGHTMAP_MIN, HEIGHTMAP_MEAN, HEIGHTMAP_COUNT, HEIGHTMAP_VARIANCE };
+    if (fusion.enabled) {
+        layers.push_back(HEIGHTMAP_FUSED);
+        layers.push_back(HEIGHTMAP_FUSED_VARIANCE);
+    }
+
+    Mat matrix, output;
     char deprojected_filename[100];
-    if(n_images != 1){
-        for(int n_image = 1; n_image < n_images; n_image++){
-            Mat matrix_to_be_merged = Mat::zeros(num_rows, num_cols, CV_32SC1);
-            Vector3f camera_position = populate_matrix_from_file(filenames[n_image].c_str(), matrix_to_be_merged, center_y, center_x, cell_dim, num_rows, num_cols);
-            Mat big_matrix_combined2_photo = matrix_to_be_merged.clone();
+    for (int n_image = 0; n_image < n_images; n_image++) {
+        sprintf(deprojected_filename, "../data/heightmap_image%d.dhm", n_image);
+        write_heightmap_file(deprojected_filename, image_heightmaps[n_image], layout, layers, HEIGHTMAP_TILED, camera_positions[n_image].data(),
+                             camera_angles[n_image].data());
+        if (!exports.enabled(EXPORT_HEIGHTMAP_TEXT | EXPORT_HEIGHTMAP_PNG)) {
+            continue;
+        }
+        image_heightmaps[n_image].to_mat(layout, matrix);
+        if (exports.enabled(EXPORT_HEIGHTMAP_TEXT)) {
             sprintf(deprojected_filename, "../data/deprojected_points%d.txt", n_image);
-            save_matrix_with_zeros(big_matrix_combined2_photo, deprojected_filename, num_rows, num_cols, camera_position);
-            normalizeAndInvert(big_matrix_combined2_photo, output);
+            save_matrix_with_zeros(matrix, deprojected_filename, layout.n_rows, layout.n_cols, camera_positions[n_image]);
+        }
+        if (exports.enabled(EXPORT_HEIGHTMAP_PNG)) {
+            normalizeAndInvert(matrix, output);
             sprintf(deprojected_filename, "../data/deprojected_image%d.png", n_image);
             imwrite(deprojected_filename, output);
+        }
+    }
 
-            if(check_matrix(big_matrix_combined, matrix_to_be_merged, num_rows, num_cols, e)){
-                populate_matrix_from_file(filenames[n_image].c_str(), big_matrix_combined, center_y, center_x, cell_dim, num_rows, num_cols);
-                cout << "Image " << n_image << " merged" << endl;
-            }
-            else{
-                cout << "Images too diferent to be merged" << endl;
-            }
+    write_heightmap_file("../data/combinated_heightmap.dhm", big_heightmap_combined, layout, layers, HEIGHTMAP_TILED, camera_positions[0].data(),
+                         camera_angles[0].data());
+    if (exports.enabled(EXPORT_HEIGHTMAP_TEXT | EXPORT_HEIGHTMAP_PNG)) {
+        if (fusion.enabled) {
+            // The fused heights, rounded to the millimeter like the other dumps
+            Mat fused;
+            big_heightmap_combined.to_mat(layout, fused, HEIGHTMAP_FUSED);
+            fused.convertTo(matrix, CV_32S);
+        } else {
+            big_heightmap_combined.to_mat(layout, matrix);
+        }
+        if (exports.enabled(EXPORT_HEIGHTMAP_TEXT)) {
+            save_matrix_with_zeros(matrix, "../data/combinated_deprojected_points.txt", layout.n_rows, layout.n_cols, camera_positions[0]);
+        }
+        if (exports.enabled(EXPORT_HEIGHTMAP_PNG)) {
+            normalizeAndInvert(matrix, output);
+            imwrite("../data/combinated_deprojected_image.png", output);
         }
     }
-    else{
-        cout << "Only one image" << endl;
+
+    if (traversability.enabled) {
+        TraversabilityMap traversability_map;
+        compute_traversability(big_heightmap_combined, layout, traversability, traversability_map, capture_options.n_workers);
+        #if DEBUG
+        printf("Navigable cells: %llu, blocked cells: %llu\n", (unsigned long long)traversability_map.n_navigable,
+               (unsigned long long)traversability_map.n_blocked);
+        #endif
+        write_traversability("../data/traversability", traversability_map);
     }
 
-    save_matrix_with_zeros(big_matrix_combined, "../data/combinated_deprojected_points.txt", num_rows, num_cols, o_camera_position);
-    normalizeAndInvert(big_matrix_combined, output);
-    imwrite("../data/combinated_deprojected_image.png", output);
-    
-    // system("source ~/Desktop/robotics_project/.venv/bin/activate");
-    system("python ../hystogram.py");
+    // Statistics of the combined heightmap
+    MapStats map_stats;
+    compute_map_stats(big_heightmap_combined, layout, layers, fusion.enabled ? HEIGHTMAP_FUSED : HEIGHTMAP_MAX, map_stats);
+    write_map_stats("../data/map_stats.json", map_stats);
+    #if DEBUG
+    printf("Observed cells: %llu of %llu (%.1f%%), median height: %.0f mm\n", (unsigned long long)map_stats.n_written,
+           (unsigned long long)map_stats.n_cells, 100.0 * map_stats.fill_ratio, map_stats.median());
+    #endif
+    if (exports.enabled(EXPORT_HISTOGRAM_PNG)) {
+        Mat histogram;
+        render_histogram(map_stats, histogram);
+        imwrite("../data/histogram.png", histogram);
+    }
     return 0;
 }
@@ -0,0 +1,184 @@
+#include "resources.h"
+#include <cfloat>
+
+// Calls visit(value) with the values of one layer of the written cells of a tile inside the layout
+template <typename Visit>
+static void visit_tile_layer(const TiledHeightmap::Tile& tile, const HeightmapLayout& layout, HeightmapLayer layer,
+                             vector<uint32_t>& values, Visit visit) {
+    int col0 = layout.center_col + tile.tx * HEIGHTMAP_TILE;
+    int first = max(0, -col0);
+    int last = min(HEIGHTMAP_TILE, layout.n_cols - col0);
+    int row0 = layout.center_row - tile.ty * HEIGHTMAP_TILE;
+    if (first >= last || row0 < 0 || row0 - HEIGHTMAP_TILE + 1 >= layout.n_rows) {
+        return;
+    }
+    heightmap_tile_layer(tile, layer, values.data());
+    bool is_float = heightmap_layer_type(layer) == CV_32FC1;
+    const int* ints = reinterpret_cast<const int*>(values.data());
+    const float* floats = reinterpret_cast<const float*>(values.data());
+    for (int y = 0; y < HEIGHTMAP_TILE; ++y) {
+        int row = row0 - y;
+        if (row < 0 || row >= layout.n_rows) {
+            continue;
+        }
+        for (int x = first; x < last; ++x) {
+            int i = y * HEIGHTMAP_TILE + x;
+            if (tile.count[i] != 0) {
+                visit(is_float ? (double)floats[i] : (double)ints[i]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Computes the statistics of a heightmap: fill ratio, histogram and percentiles of the heights, and range of each layer.
+ *
+ * The percentiles are exact to the millimeter: the heights are first counted in 1 mm bins,
+ * which are then gathered in the MAP_STATS_BINS bins of the histogram.
+ *
+ * @param heightmap The heightmap.
+ * @param layout The cells taken into account.
+ * @param layers The layers whose range is computed.
+ * @param heights The layer of the histogram and the percentiles.
+ * @param stats Receives the statistics.
+ */
+void compute_map_stats(const TiledHeightmap& heightmap, const HeightmapLayout& layout, const vector<HeightmapLayer>& layers,
+                       HeightmapLayer heights, MapStats& stats) {
+    stats = MapStats();
+    stats.heights = heights;
+    stats.n_cells = (uint64_t)layout.n_rows * layout.n_cols;
+    stats.percentile_levels = MAP_STATS_PERCENTILES;
+    stats.histogram.assign(MAP_STATS_BINS, 0);
+    vector<uint32_t> values(HEIGHTMAP_TILE * HEIGHTMAP_TILE);
+
+    for (HeightmapLayer layer : layers) {
+        LayerRange range = { layer, DBL_MAX, -DBL_MAX };
+        for (const TiledHeightmap::Tile& tile : heightmap.get_tiles()) {
+            visit_tile_layer(tile, layout, layer, values, [&](double value) {
+                range.min = min(range.min, value);
+                range.max = max(range.max, value);
+            });
+        }
+        if (range.min <= range.max) {
+            stats.layers.push_back(range);
+        }
+    }
+
+    // Heights in 1 mm bins
+    long lowest = LONG_MAX, highest = LONG_MIN;
+    for (const TiledHeightmap::Tile& tile : heightmap.get_tiles()) {
+        visit_tile_layer(tile, layout, heights, values, [&](double value) {
+            long height = lround(value);
+            lowest = min(lowest, height);
+            highest = max(highest, height);
+            stats.n_written++;
+        });
+    }
+    if (stats.n_written == 0) {
+        stats.percentiles.assign(stats.percentile_levels.size(), 0.0);
+        return;
+    }
+    stats.fill_ratio = (double)stats.n_written / stats.n_cells;
+    vector<uint64_t> millimeters(highest - lowest + 1, 0);
+    for (const TiledHeightmap::Tile& tile : heightmap.get_tiles()) {
+        visit_tile_layer(tile, layout, heights, values, [&](double value) {
+            millimeters[lround(value) - lowest]++;
+        });
+    }
+
+    for (double level : stats.percentile_levels) {
+        uint64_t target = max<uint64_t>(1, (uint64_t)ceil(level * stats.n_written));
+        uint64_t cumulative = 0;
+        size_t bin = 0;
+        while (bin < millimeters.size() - 1 && cumulative + millimeters[bin] < target) {
+            cumulative += millimeters[bin++];
+        }
+        stats.percentiles.push_back((double)(lowest + (long)bin));
+    }
+
+    stats.histogram_min = lowest;
+    stats.bin_width = max(1.0, (double)(highest - lowest + 1) / MAP_STATS_BINS);
+    for (size_t bin = 0; bin < millimeters.size(); bin++) {
+        size_t coarse = min<size_t>(MAP_STATS_BINS - 1, (size_t)(bin / stats.bin_width));
+        stats.histogram[coarse] += millimeters[bin];
+    }
+    return;
+}
+
+/**
+ * @brief Writes the statistics of a heightmap as JSON.
+ *
+ * @param filename The file to write.
+ * @param stats The statistics.
+ * @return true if the file was written.
+ */
+bool write_map_stats(const char filename[], const MapStats& stats) {
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"heights\": \"%s\",\n", heightmap_layer_name(stats.heights));
+    fprintf(file, "  \"cells\": %llu,\n", (unsigned long long)stats.n_cells);
+    fprintf(file, "  \"written_cells\": %llu,\n", (unsigned long long)stats.n_written);
+    fprintf(file, "  \"fill_ratio\": %.6f,\n", stats.fill_ratio);
+    fprintf(file, "  \"percentiles\": {");
+    for (size_t i = 0; i < stats.percentiles.size(); i++) {
+        fprintf(file, "%s\"p%g\": %.0f", i ? ", " : "", 100.0 * stats.percentile_levels[i], stats.percentiles[i]);
+    }
+    fprintf(file, "},\n");
+    fprintf(file, "  \"histogram\": {\"min\": %.0f, \"bin_width\": %.3f, \"counts\": [", stats.histogram_min, stats.bin_width);
+    for (size_t i = 0; i < stats.histogram.size(); i++) {
+        fprintf(file, "%s%llu", i ? ", " : "", (unsigned long long)stats.histogram[i]);
+    }
+    fprintf(file, "]},\n");
+    fprintf(file, "  \"layers\": {");
+    for (size_t i = 0; i < stats.layers.size(); i++) {
+        fprintf(file, "%s\n    \"%s\": {\"min\": %.3f, \"max\": %.3f}", i ? "," : "", heightmap_layer_name(stats.layers[i].layer),
+                stats.layers[i].min, stats.layers[i].max);
+    }
+    fprintf(file, "\n  }\n}\n");
+    bool written = !ferror(file);
+    fclose(file);
+    return written;
+}
+
+/**
+ * @brief Draws the histogram of the heights.
+ *
+ * @param stats The statistics.
+ * @param image Receives the plot (CV_8UC3).
+ */
+void render_histogram(const MapStats& stats, Mat& image) {
+    const int width = 640, height = 480, left = 70, right = 20, top = 40, bottom = 50;
+    image = Mat(height, width, CV_8UC3, Scalar(255, 255, 255));
+    putText(image, "Histogram of Non-Zero Matrix Values", Point(left, 25), FONT_HERSHEY_SIMPLEX, 0.6, Scalar(0, 0, 0), 1, LINE_AA);
+    int plot_width = width - left - right, plot_height = height - top - bottom;
+    rectangle(image, Point(left, top), Point(left + plot_width, top + plot_height), Scalar(0, 0, 0), 1);
+    uint64_t highest = 0;
+    for (uint64_t count : stats.histogram) {
+        highest = max(highest, count);
+    }
+    if (highest == 0) {
+        return;
+    }
+    int n_bins = stats.histogram.size();
+    for (int bin = 0; bin < n_bins; bin++) {
+        int x0 = left + bin * plot_width / n_bins;
+        int x1 = left + (bin + 1) * plot_width / n_bins;
+        int y0 = top + plot_height - (int)(stats.histogram[bin] * plot_height / highest);
+        rectangle(image, Point(x0, y0), Point(x1, top + plot_height), Scalar(180, 119, 31), FILLED);
+        rectangle(image, Point(x0, y0), Point(x1, top + plot_height), Scalar(0, 0, 0), 1);
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%.0f", stats.histogram_min);
+    putText(image, label, Point(left - 10, top + plot_height + 20), FONT_HERSHEY_SIMPLEX, 0.45, Scalar(0, 0, 0), 1, LINE_AA);
+    snprintf(label, sizeof(label), "%.0f", stats.histogram_min + stats.bin_width * n_bins);
+    putText(image, label, Point(left + plot_width - 30, top + plot_height + 20), FONT_HERSHEY_SIMPLEX, 0.45, Scalar(0, 0, 0), 1, LINE_AA);
+    putText(image, "Value (mm)", Point(left + plot_width / 2 - 40, height - 10), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(0, 0, 0), 1, LINE_AA);
+    snprintf(label, sizeof(label), "%llu", (unsigned long long)highest);
+    putText(image, label, Point(5, top + 10), FONT_HERSHEY_SIMPLEX, 0.45, Scalar(0, 0, 0), 1, LINE_AA);
+    putText(image, "Frequency", Point(5, top + plot_height / 2), FONT_HERSHEY_SIMPLEX, 0.45, Scalar(0, 0, 0), 1, LINE_AA);
+    return;
+}
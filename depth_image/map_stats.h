@@ -0,0 +1,51 @@
+#ifndef MAP_STATS_H
+#define MAP_STATS_H
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "heightmap.h"
+
+// Bins of the histogram of the heights
+#define MAP_STATS_BINS 50
+// Percentiles of the heights in the report
+#define MAP_STATS_PERCENTILES { 0.05, 0.25, 0.5, 0.75, 0.95 }
+
+// Range of the written cells of one layer
+struct LayerRange {
+    HeightmapLayer layer;
+    double min;
+    double max;
+};
+
+// Statistics of a heightmap over a dense layout
+struct MapStats {
+    HeightmapLayer heights = HEIGHTMAP_MAX;  // Layer of the histogram and the percentiles
+    uint64_t n_cells = 0;                    // Cells of the layout
+    uint64_t n_written = 0;                  // Cells with at least one point
+    double fill_ratio = 0.0;
+    std::vector<double> percentile_levels;
+    std::vector<double> percentiles;         // Heights (mm), rounded to the millimeter
+    double histogram_min = 0.0;              // Lower edge of the first bin (mm)
+    double bin_width = 0.0;                  // mm
+    std::vector<uint64_t> histogram;         // MAP_STATS_BINS bins
+    std::vector<LayerRange> layers;
+
+    // Height at one of the percentile_levels, 0 if it is not one of them
+    double percentile(double level) const {
+        for (size_t i = 0; i < percentile_levels.size() && i < percentiles.size(); i++) {
+            if (percentile_levels[i] == level) {
+                return percentiles[i];
+            }
+        }
+        return 0.0;
+    }
+    double median() const { return percentile(0.5); }
+};
+
+void compute_map_stats(const TiledHeightmap& heightmap, const HeightmapLayout& layout, const std::vector<HeightmapLayer>& layers,
+                       HeightmapLayer heights, MapStats& stats);
+bool write_map_stats(const char filename[], const MapStats& stats);
+void render_histogram(const MapStats& stats, cv::Mat& image);
+
+#endif // MAP_STATS_H
@@ -0,0 +1,50 @@
+#include "resources.h"
+#include <mutex>
+
+/**
+ * @brief Computes the unit-depth ray of every pixel.
+ *
+ * @param intrinsics The camera intrinsics.
+ */
+void RayTable::build(const rs2_intrinsics& intrinsics) {
+    this->intrinsics = intrinsics;
+    width = intrinsics.width;
+    ray_x.resize((size_t)intrinsics.width * intrinsics.height);
+    ray_y.resize((size_t)intrinsics.width * intrinsics.height);
+    for (int v = 0; v < intrinsics.height; ++v) {
+        for (int u = 0; u < intrinsics.width; ++u) {
+            float point[3];
+            float pixel[2] = { static_cast<float>(u), static_cast<float>(v) };
+            rs2_deproject_pixel_to_point(point, &intrinsics, pixel, 1.0f);
+            ray_x[(size_t)v * width + u] = point[0];
+            ray_y[(size_t)v * width + u] = point[1];
+        }
+    }
+    valid = true;
+    return;
+}
+
+bool RayTable::matches(const rs2_intrinsics& other) const {
+    return valid && memcmp(&intrinsics, &other, sizeof(rs2_intrinsics)) == 0;
+}
+
+/**
+ * @brief Returns the ray table of the given intrinsics, building it on first use.
+ *
+ * The last table is cached, so it is only rebuilt when the intrinsics change. A rebuild makes
+ * a new table, the callers still holding the previous one keep it until they release it.
+ *
+ * @param intrinsics The camera intrinsics.
+ * @return shared_ptr<const RayTable> The ray table.
+ */
+shared_ptr<const RayTable> get_ray_table(const rs2_intrinsics& intrinsics) {
+    static shared_ptr<const RayTable> table;
+    static mutex table_mutex;
+    lock_guard<mutex> lock(table_mutex);
+    if (!table || !table->matches(intrinsics)) {
+        auto rays = make_shared<RayTable>();
+        rays->build(intrinsics);
+        table = rays;
+    }
+    return table;
+}
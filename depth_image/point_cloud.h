@@ -0,0 +1,53 @@
+#ifndef POINT_CLOUD_H
+#define POINT_CLOUD_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <librealsense2/rs.hpp>
+
+/**
+ * @brief 3D points stored as structure-of-arrays (one column per coordinate).
+ */
+struct PointCloud {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    void resize(size_t n) {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+    }
+    void clear() { resize(0); }
+};
+
+/**
+ * @brief Per-pixel unit-depth rays of a camera.
+ *
+ * Deprojecting a pixel is linear in its depth for every librealsense distortion model, so the
+ * point of pixel (u, v) at depth d is (ray_x * d, ray_y * d, d). The rays are computed once
+ * per intrinsics with rs2_deproject_pixel_to_point(), distortion included.
+ */
+class RayTable {
+public:
+    RayTable() : valid(false) {}
+
+    void build(const rs2_intrinsics& intrinsics);
+    bool matches(const rs2_intrinsics& intrinsics) const;
+    const float* row_x(int v) const { return ray_x.data() + (size_t)v * width; }
+    const float* row_y(int v) const { return ray_y.data() + (size_t)v * width; }
+
+private:
+    bool valid;
+    int width;
+    rs2_intrinsics intrinsics;
+    std::vector<float> ray_x;
+    std::vector<float> ray_y;
+};
+
+std::shared_ptr<const RayTable> get_ray_table(const rs2_intrinsics& intrinsics);
+
+#endif // POINT_CLOUD_H
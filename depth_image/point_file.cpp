@@ -0,0 +1,204 @@
+#include "resources.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Writes points in the binary point file format to a stream.
+ *
+ * @param file The stream, opened in binary mode.
+ * @param points The points.
+ * @param frame The frame of reference of the points.
+ * @param encoding How the coordinates are stored.
+ * @param camera_position The camera position of the image.
+ * @param camera_angle The camera angle of the image.
+ * @param intrinsics The camera intrinsics of the image.
+ * @return true if the points were written.
+ */
+bool write_point_file(ostream& file, const PointCloud& points, PointFrame frame, PointEncoding encoding,
+                      const float camera_position[3], const float camera_angle[3], const rs2_intrinsics& intrinsics) {
+    PointFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POINT_FILE_MAGIC, 4);
+    header.version = POINT_FILE_VERSION;
+    header.encoding = encoding;
+    header.frame = frame;
+    header.count = points.size();
+    for (int i = 0; i < 3; i++) {
+        header.camera_position[i] = camera_position[i];
+        header.camera_angle[i] = camera_angle[i];
+    }
+    for (size_t i = 0; i < points.size(); i++) {
+        header.max_abs_x = max(header.max_abs_x, std::abs(points.x[i]));
+        header.max_abs_y = max(header.max_abs_y, std::abs(points.y[i]));
+    }
+    header.width = intrinsics.width;
+    header.height = intrinsics.height;
+    header.ppx = intrinsics.ppx;
+    header.ppy = intrinsics.ppy;
+    header.fx = intrinsics.fx;
+    header.fy = intrinsics.fy;
+    header.model = intrinsics.model;
+    for (int i = 0; i < 5; i++) {
+        header.coeffs[i] = intrinsics.coeffs[i];
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const vector<float>* columns[3] = { &points.x, &points.y, &points.z };
+    for (int axis = 0; axis < 3; axis++) {
+        if (encoding == POINTS_FLOAT32) {
+            file.write(reinterpret_cast<const char*>(columns[axis]->data()), points.size() * sizeof(float));
+        } else {
+            vector<int16_t> column(points.size());
+            for (size_t i = 0; i < points.size(); i++) {
+                column[i] = (int16_t)std::max(-32768.0f, std::min(32767.0f, std::round((*columns[axis])[i])));
+            }
+            file.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(int16_t));
+        }
+    }
+    return file.good();
+}
+
+/**
+ * @brief Writes points to a binary point file.
+ *
+ * @param filename The file to write.
+ * @return true if the file was written.
+ *
+ * The other parameters are those of write_point_file(ostream&, ...).
+ */
+bool write_point_file(const char filename[], const PointCloud& points, PointFrame frame, PointEncoding encoding,
+                      const float camera_position[3], const float camera_angle[3], const rs2_intrinsics& intrinsics) {
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    return write_point_file(file, points, frame, encoding, camera_position, camera_angle, intrinsics);
+}
+
+/**
+ * @brief Checks whether a file starts with the point file magic.
+ *
+ * @param filename The file to check.
+ * @return true if it is a binary point file.
+ */
+bool is_point_file(const char filename[]) {
+    ifstream file(filename, ios::binary);
+    char magic[4];
+    return file.read(magic, 4) && memcmp(magic, POINT_FILE_MAGIC, 4) == 0;
+}
+
+/**
+ * @brief Maps a binary point file in memory and validates its header.
+ *
+ * @param filename The file to map.
+ * @return true if the file was mapped and is a valid point file.
+ */
+bool MappedPointFile::open(const char filename[]) {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PointFileHeader)) {
+        cerr << "Invalid point file " << filename << endl;
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        cerr << "Error mapping file " << filename << endl;
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+    length = st.st_size;
+    owned = true;
+    if (!valid()) {
+        cerr << "Invalid point file " << filename << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Uses point file data already in memory, such as a record of a mapped session file.
+ *
+ * The data is not copied and must outlive the object.
+ *
+ * @param data The point file data.
+ * @param length The length of the data in bytes.
+ * @return true if the data is a valid point file.
+ */
+bool MappedPointFile::view(const void* data, size_t length) {
+    close();
+    this->data = static_cast<const uint8_t*>(data);
+    this->length = length;
+    owned = false;
+    if (length < sizeof(PointFileHeader) || !valid()) {
+        cerr << "Invalid point data" << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedPointFile::valid() const {
+    const PointFileHeader& h = header();
+    size_t value_size = h.encoding == POINTS_FLOAT32 ? sizeof(float) : sizeof(int16_t);
+    // The count comes from the file, dividing the length instead of multiplying it cannot overflow
+    return memcmp(h.magic, POINT_FILE_MAGIC, 4) == 0 && h.version == POINT_FILE_VERSION &&
+           h.encoding <= POINTS_INT16_MM && h.count <= (length - sizeof(PointFileHeader)) / (3 * value_size);
+}
+
+void MappedPointFile::close() {
+    if (data) {
+        if (owned) {
+            munmap(const_cast<uint8_t*>(data), length);
+        }
+        data = nullptr;
+        length = 0;
+    }
+}
+
+rs2_intrinsics MappedPointFile::intrinsics() const {
+    const PointFileHeader& h = header();
+    rs2_intrinsics intrinsics;
+    intrinsics.width = h.width;
+    intrinsics.height = h.height;
+    intrinsics.ppx = h.ppx;
+    intrinsics.ppy = h.ppy;
+    intrinsics.fx = h.fx;
+    intrinsics.fy = h.fy;
+    intrinsics.model = (rs2_distortion)h.model;
+    for (int i = 0; i < 5; i++) {
+        intrinsics.coeffs[i] = h.coeffs[i];
+    }
+    return intrinsics;
+}
+
+/**
+ * @brief Copies the points of the file into a point cloud.
+ *
+ * @param points Receives the points, in milimiters whatever the encoding.
+ */
+void MappedPointFile::read(PointCloud& points) const {
+    points.resize(size());
+    vector<float>* columns[3] = { &points.x, &points.y, &points.z };
+    for (int axis = 0; axis < 3; axis++) {
+        if (header().encoding == POINTS_FLOAT32) {
+            memcpy(columns[axis]->data(), float_column(axis), size() * sizeof(float));
+        } else {
+            const int16_t* column = int16_column(axis);
+            for (size_t i = 0; i < size(); i++) {
+                (*columns[axis])[i] = column[i];
+            }
+        }
+    }
+    return;
+}
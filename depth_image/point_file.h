@@ -0,0 +1,89 @@
+#ifndef POINT_FILE_H
+#define POINT_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <librealsense2/rs.hpp>
+#include "point_cloud.h"
+
+#define POINT_FILE_MAGIC "DPTS"
+#define POINT_FILE_VERSION 1
+
+// How the coordinates are stored in a point file
+enum PointEncoding : uint32_t {
+    POINTS_FLOAT32 = 0,   // float, in milimiters
+    POINTS_INT16_MM = 1   // int16_t, rounded to whole milimiters
+};
+
+// Frame of reference of the points of a point file
+enum PointFrame : uint32_t {
+    POINTS_CAMERA = 0,
+    POINTS_WORLD = 1
+};
+
+/**
+ * @brief Header of a binary point file, followed by the x, y and z columns of count points.
+ *
+ * All values are little-endian. The header is 128 bytes long, so the columns are aligned and
+ * can be used in place when the file is memory mapped.
+ */
+struct PointFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t encoding;
+    uint32_t frame;
+    uint64_t count;
+    float camera_position[3];
+    float camera_angle[3];
+    float max_abs_x;
+    float max_abs_y;
+    int32_t width;
+    int32_t height;
+    float ppx;
+    float ppy;
+    float fx;
+    float fy;
+    int32_t model;
+    float coeffs[5];
+    uint8_t reserved[24];
+};
+static_assert(sizeof(PointFileHeader) == 128, "PointFileHeader must be 128 bytes");
+
+bool write_point_file(std::ostream& file, const PointCloud& points, PointFrame frame, PointEncoding encoding,
+                      const float camera_position[3], const float camera_angle[3], const rs2_intrinsics& intrinsics);
+bool write_point_file(const char filename[], const PointCloud& points, PointFrame frame, PointEncoding encoding,
+                      const float camera_position[3], const float camera_angle[3], const rs2_intrinsics& intrinsics);
+bool is_point_file(const char filename[]);
+
+/**
+ * @brief Read-only memory mapping of a binary point file, or view of point file data in memory.
+ */
+class MappedPointFile {
+public:
+    MappedPointFile() : data(nullptr), length(0), owned(false) {}
+    ~MappedPointFile() { close(); }
+    MappedPointFile(const MappedPointFile&) = delete;
+    MappedPointFile& operator=(const MappedPointFile&) = delete;
+
+    bool open(const char filename[]);
+    bool view(const void* data, size_t length);
+    void close();
+
+    const PointFileHeader& header() const { return *reinterpret_cast<const PointFileHeader*>(data); }
+    size_t size() const { return header().count; }
+    rs2_intrinsics intrinsics() const;
+    // Column pointers, only valid for the encoding of the file
+    const float* float_column(int axis) const { return reinterpret_cast<const float*>(data + sizeof(PointFileHeader)) + axis * size(); }
+    const int16_t* int16_column(int axis) const { return reinterpret_cast<const int16_t*>(data + sizeof(PointFileHeader)) + axis * size(); }
+    void read(PointCloud& points) const;
+
+private:
+    bool valid() const;
+
+    const uint8_t* data;
+    size_t length;
+    bool owned;  // Whether data is a mapping to unmap on close()
+};
+
+#endif // POINT_FILE_H
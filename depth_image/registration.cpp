@@ -0,0 +1,226 @@
+#include "resources.h"
+#include <cfloat>
+
+/**
+ * @brief Converts a grid to float, with the mean of its written cells subtracted.
+ *
+ * Empty cells stay at 0, so they do not correlate with anything.
+ *
+ * @param grid The grid (CV_32SC1).
+ * @param prepared Receives the grid (CV_32FC1).
+ */
+static void prepare_grid(const Mat& grid, Mat& prepared) {
+    Mat valid = grid != 0;
+    grid.convertTo(prepared, CV_32F);
+    Scalar valid_mean = mean(prepared, valid);
+    subtract(prepared, valid_mean, prepared, valid);
+    return;
+}
+
+/**
+ * @brief Computes the polar transform of the centered log magnitude spectrum of a grid.
+ *
+ * The magnitude spectrum does not depend on translations, and rotating the grid rotates it by
+ * the same angle, which shifts its polar transform along the rows (one row per degree).
+ *
+ * @param grid The grid (CV_32FC1).
+ * @param polar Receives the polar spectrum, 360 rows of angles and one column per radius.
+ */
+static void polar_spectrum(const Mat& grid, Mat& polar) {
+    Mat even = grid(Rect(0, 0, grid.cols & ~1, grid.rows & ~1));
+    Mat window;
+    createHanningWindow(window, even.size(), CV_32F);
+    Mat planes[] = { even.mul(window), Mat::zeros(even.size(), CV_32F) };
+    Mat spectrum;
+    merge(planes, 2, spectrum);
+    dft(spectrum, spectrum);
+    split(spectrum, planes);
+    magnitude(planes[0], planes[1], planes[0]);
+    Mat spectrum_magnitude = planes[0];
+    spectrum_magnitude += Scalar::all(1);
+    log(spectrum_magnitude, spectrum_magnitude);
+
+    // Swap the quadrants so the zero frequency is at the center
+    int cx = spectrum_magnitude.cols / 2;
+    int cy = spectrum_magnitude.rows / 2;
+    Mat q0(spectrum_magnitude, Rect(0, 0, cx, cy)), q1(spectrum_magnitude, Rect(cx, 0, cx, cy));
+    Mat q2(spectrum_magnitude, Rect(0, cy, cx, cy)), q3(spectrum_magnitude, Rect(cx, cy, cx, cy));
+    Mat tmp;
+    q0.copyTo(tmp);
+    q3.copyTo(q0);
+    tmp.copyTo(q3);
+    q1.copyTo(tmp);
+    q2.copyTo(q1);
+    tmp.copyTo(q2);
+
+    int radius = min(cx, cy);
+    warpPolar(spectrum_magnitude, polar, Size(radius, 360), Point2f(cx, cy), radius, INTER_LINEAR | WARP_POLAR_LINEAR);
+    // The lowest frequencies carry no usable orientation
+    polar = polar.colRange(min(2, polar.cols - 1), polar.cols).clone();
+    return;
+}
+
+/**
+ * @brief Estimates the rotation that brings a grid onto another one.
+ *
+ * @param image The grid to rotate (CV_32FC1).
+ * @param reference The reference grid, same size (CV_32FC1).
+ * @return double The angle (degrees, from the columns towards the rows) in (-90, 90].
+ */
+static double estimate_rotation(const Mat& image, const Mat& reference) {
+    Mat polar_image, polar_reference;
+    polar_spectrum(image, polar_image);
+    polar_spectrum(reference, polar_reference);
+    Point2d shift = phaseCorrelate(polar_image, polar_reference);
+    double angle = shift.y * 360.0 / polar_image.rows;
+    // The magnitude spectrum repeats every 180 degrees
+    while (angle > 90.0) angle -= 180.0;
+    while (angle <= -90.0) angle += 180.0;
+    return angle;
+}
+
+// Rotates the content of a grid by angle degrees (from the columns towards the rows) around its center
+static void rotate_grid(const Mat& grid, Mat& rotated, double angle) {
+    Point2f center((grid.cols - 1) / 2.0f, (grid.rows - 1) / 2.0f);
+    warpAffine(grid, rotated, getRotationMatrix2D(center, -angle, 1.0), grid.size(), INTER_LINEAR, BORDER_CONSTANT, Scalar::all(0));
+}
+
+// Moves the content of a grid by shift cells
+static void translate_grid(const Mat& grid, Mat& translated, Point2d shift) {
+    Mat M = (Mat_<double>(2, 3) << 1, 0, shift.x, 0, 1, shift.y);
+    warpAffine(grid, translated, M, grid.size(), INTER_LINEAR, BORDER_CONSTANT, Scalar::all(0));
+}
+
+// Resizes a grid so its largest side is at most max_size, returns the scale (>= 1) of one pixel in input pixels
+static double reduce_grid(const Mat& grid, Mat& reduced, int max_size) {
+    double scale = max(1.0, (double)max(grid.rows, grid.cols) / max_size);
+    if (scale == 1.0) {
+        reduced = grid;
+        return scale;
+    }
+    Size size(max(1, (int)lround(grid.cols / scale)), max(1, (int)lround(grid.rows / scale)));
+    resize(grid, reduced, size, 0, 0, INTER_AREA);
+    return scale;
+}
+
+/**
+ * @brief Estimates the XY offset and yaw that align an image with the combined heightmap.
+ *
+ * Both heightmaps are rendered over the area of the image, extended by options.search, and
+ * reduced to a two level pyramid. The yaw is estimated on the coarse level by phase
+ * correlation of the polar magnitude spectra, the offset by phase correlation of the grids:
+ * first on the coarse level, then refined on the fine level. The correction is applied to
+ * the cells of the image, resampled to the nearest cell.
+ *
+ * @param combined The combined heightmap.
+ * @param image The heightmap of the image.
+ * @param options The settings of the registration.
+ * @param registration Receives the estimated correction.
+ * @param corrected Receives the corrected heightmap of the image (same cell dimension).
+ * @return true if a correction was found, false if the estimate is unreliable or out of range.
+ */
+bool register_heightmap(const TiledHeightmap& combined, const TiledHeightmap& image, const RegistrationOptions& options,
+                        Registration& registration, TiledHeightmap& corrected) {
+    #if DEBUG
+    auto start = chrono::steady_clock::now();
+    #endif
+    int x0, y0, x1, y1;
+    if (!image.bounds(x0, y0, x1, y1) || combined.empty()) {
+        return false;
+    }
+    int cell_dim = image.get_cell_dim();
+    int margin = max(1, (int)ceil(options.search / cell_dim));
+    HeightmapLayout window;
+    window.center_row = y1 + margin;
+    window.center_col = margin - x0;
+    window.n_rows = (y1 - y0) + 2 * margin + 1;
+    window.n_cols = (x1 - x0) + 2 * margin + 1;
+
+    Mat image_grid, combined_grid, image_full, combined_full;
+    image.to_mat(window, image_grid);
+    combined.to_mat(window, combined_grid);
+    prepare_grid(image_grid, image_full);
+    prepare_grid(combined_grid, combined_full);
+
+    // Two level pyramid
+    Mat image_fine, combined_fine, image_coarse, combined_coarse;
+    double fine_scale = reduce_grid(image_full, image_fine, options.fine_size);
+    reduce_grid(combined_full, combined_fine, options.fine_size);
+    double coarse_scale = reduce_grid(image_fine, image_coarse, options.coarse_size);
+    reduce_grid(combined_fine, combined_coarse, options.coarse_size);
+
+    // Yaw on the coarse level
+    double angle = 0.0;
+    if (options.max_yaw > 0) {
+        angle = estimate_rotation(image_coarse, combined_coarse);
+        if (std::abs(angle) > options.max_yaw) {
+            angle = 0.0;
+        }
+    }
+
+    // Offset, coarse then fine
+    Mat rotated, shifted, hanning;
+    rotate_grid(image_coarse, rotated, angle);
+    createHanningWindow(hanning, rotated.size(), CV_32F);
+    Point2d coarse_shift = phaseCorrelate(rotated, combined_coarse, hanning);
+
+    rotate_grid(image_fine, rotated, angle);
+    Point2d shift(coarse_shift.x * coarse_scale, coarse_shift.y * coarse_scale);
+    translate_grid(rotated, shifted, shift);
+    createHanningWindow(hanning, shifted.size(), CV_32F);
+    double response = 0.0;
+    Point2d residual = phaseCorrelate(shifted, combined_fine, hanning, &response);
+    shift.x = (shift.x + residual.x) * fine_scale;
+    shift.y = (shift.y + residual.y) * fine_scale;
+
+    registration.dx = shift.x * cell_dim;
+    registration.dy = -shift.y * cell_dim;
+    registration.yaw = -angle;
+    registration.response = response;
+    #if DEBUG
+    printf("Registration: dx %.1f mm, dy %.1f mm, yaw %.2f deg, response %.3f (%.0f ms)\n", registration.dx, registration.dy,
+           registration.yaw, response, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    #endif
+    if (response < options.min_response || std::abs(shift.x) > margin || std::abs(shift.y) > margin) {
+        return false;
+    }
+
+    // Resample the image: window pixel q comes from p = R(-angle) (q - center - shift) + center
+    double c = cos(angle * M_PI / 180.0), s = sin(angle * M_PI / 180.0);
+    double center_col = (window.n_cols - 1) / 2.0, center_row = (window.n_rows - 1) / 2.0;
+    corrected = TiledHeightmap(cell_dim);
+    for (const TiledHeightmap::Tile& tile : image.get_tiles()) {
+        int tile_cx = tile.tx * HEIGHTMAP_TILE, tile_cy = tile.ty * HEIGHTMAP_TILE;
+        // Pixels covered by the tile, and where they move
+        double col0 = tile_cx + window.center_col - 1, col1 = col0 + HEIGHTMAP_TILE + 1;
+        double row1 = window.center_row - tile_cy + 1, row0 = row1 - HEIGHTMAP_TILE - 1;
+        double q_col0 = DBL_MAX, q_col1 = -DBL_MAX, q_row0 = DBL_MAX, q_row1 = -DBL_MAX;
+        for (double col : { col0, col1 }) {
+            for (double row : { row0, row1 }) {
+                double q_col = c * (col - center_col) - s * (row - center_row) + center_col + shift.x;
+                double q_row = s * (col - center_col) + c * (row - center_row) + center_row + shift.y;
+                q_col0 = min(q_col0, q_col);
+                q_col1 = max(q_col1, q_col);
+                q_row0 = min(q_row0, q_row);
+                q_row1 = max(q_row1, q_row);
+            }
+        }
+        for (int q_row = (int)floor(q_row0); q_row <= (int)ceil(q_row1); ++q_row) {
+            for (int q_col = (int)floor(q_col0); q_col <= (int)ceil(q_col1); ++q_col) {
+                double d_col = q_col - center_col - shift.x, d_row = q_row - center_row - shift.y;
+                int p_col = (int)lround(c * d_col + s * d_row + center_col);
+                int p_row = (int)lround(-s * d_col + c * d_row + center_row);
+                int x = p_col - window.center_col - tile_cx;
+                int y = window.center_row - p_row - tile_cy;
+                if (x < 0 || x >= HEIGHTMAP_TILE || y < 0 || y >= HEIGHTMAP_TILE) {
+                    continue;
+                }
+                int i = y * HEIGHTMAP_TILE + x;
+                if (tile.cells[i] != 0) {
+                    corrected.add_cell(q_col - window.center_col, window.center_row - q_row, tile, i);
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef REGISTRATION_H
+#define REGISTRATION_H
+
+#include <opencv2/opencv.hpp>
+#include "heightmap.h"
+
+// Settings of the pose refinement done before merging an image
+struct RegistrationOptions {
+    bool enabled = false;
+    double search = 300.0;       // Largest XY correction searched (mm)
+    double max_yaw = 10.0;       // Largest yaw correction (degrees), 0 disables the yaw estimate
+    int coarse_size = 256;       // Largest side of the coarsest pyramid level (cells)
+    int fine_size = 1024;        // Largest side of the finest pyramid level (cells)
+    double min_response = 0.03;  // Phase correlation peak below which the estimate is discarded
+};
+
+// Pose correction that aligns an image with the combined heightmap
+struct Registration {
+    double dx = 0.0;        // World x offset (mm)
+    double dy = 0.0;        // World y offset (mm)
+    double yaw = 0.0;       // Rotation around the center of the image, counter-clockwise (degrees)
+    double response = 0.0;  // Phase correlation peak of the final translation estimate
+};
+
+bool register_heightmap(const TiledHeightmap& combined, const TiledHeightmap& image, const RegistrationOptions& options,
+                        Registration& registration, TiledHeightmap& corrected);
+
+#endif // REGISTRATION_H
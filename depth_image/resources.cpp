@@ -1,167 +1,658 @@
 #include "resources.h"
 // #include <sstream>
 
+/**
+ * @brief Looks for an optional "--name=value" or "--name" argument on the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param first The index of the first optional argument (after the positional ones).
+ * @param name The name of the option, without the leading dashes.
+ * @return The value of the option ("" for "--name"), or nullptr if it was not given.
+ */
+const char* get_option(int argc, char *argv[], int first, const char name[]) {
+    size_t name_len = strlen(name);
+    for (int i = first; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0 && strncmp(argv[i] + 2, name, name_len) == 0) {
+            if (argv[i][2 + name_len] == '=') {
+                return argv[i] + 3 + name_len;
+            }
+            if (argv[i][2 + name_len] == '\0') {
+                return argv[i] + 2 + name_len;
+            }
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Replaces the extension of a filename.
+ *
+ * @param filename The filename.
+ * @param extension The new extension, with its dot.
+ * @return std::string The filename with the new extension (appended if it had none).
+ */
+string replace_extension(const char filename[], const char extension[]) {
+    string name(filename);
+    size_t dot = name.find_last_of('.');
+    size_t slash = name.find_last_of('/');
+    if (dot != string::npos && (slash == string::npos || dot > slash)) {
+        name.erase(dot);
+    }
+    return name + extension;
+}
+
+/**
+ * @brief Reads the options of the capture pipeline from the command line.
+ *
+ * Recognized options are --workers=<threads accumulating each frame>,
+ * --ring=<frames that can wait to be accumulated>, --estimator=<mean|median|trimmed|mode>,
+ * --adaptive=<standard error(mm)>[,<fraction of the valid pixels>] and --min-frames=<frames>.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param first The index of the first optional argument (after the positional ones).
+ * @return CaptureOptions The options, with defaults for the ones not given.
+ */
+CaptureOptions get_capture_options(int argc, char *argv[], int first) {
+    CaptureOptions options;
+    const char* value;
+    if ((value = get_option(argc, argv, first, "workers"))) {
+        options.n_workers = max(0, atoi(value));
+    }
+    if ((value = get_option(argc, argv, first, "ring"))) {
+        options.ring_capacity = max(1, atoi(value));
+    }
+    if ((value = get_option(argc, argv, first, "estimator")) && !parse_temporal_estimator(value, options.estimator)) {
+        printf("Unknown estimator %s, using the mean.\n", value);
+    }
+    if ((value = get_option(argc, argv, first, "adaptive"))) {
+        options.target_stderr = atof(value);
+        const char* fraction = strchr(value, ',');
+        if (fraction) {
+            options.target_fraction = atof(fraction + 1);
+        }
+    }
+    if ((value = get_option(argc, argv, first, "min-frames"))) {
+        options.min_frames = max(2, atoi(value));
+    }
+    return options;
+}
+
+/**
+ * @brief Reads the thresholds of the merge decision from the command line.
+ *
+ * Recognized options are --merge-rmse=<mm>, --merge-mad=<mm>,
+ * --merge-percentile=<mm>[,<fraction>] and --merge-min-overlap=<cells>. A threshold of 0
+ * is not checked.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param first The index of the first optional argument (after the positional ones).
+ * @return SimilarityThresholds The thresholds, with defaults for the ones not given.
+ */
+SimilarityThresholds get_similarity_thresholds(int argc, char *argv[], int first) {
+    SimilarityThresholds thresholds;
+    const char* value;
+    if ((value = get_option(argc, argv, first, "merge-rmse"))) {
+        thresholds.max_rmse = atof(value);
+    }
+    if ((value = get_option(argc, argv, first, "merge-mad"))) {
+        thresholds.max_mad = atof(value);
+    }
+    if ((value = get_option(argc, argv, first, "merge-percentile"))) {
+        thresholds.max_percentile_error = atof(value);
+        const char* fraction = strchr(value, ',');
+        if (fraction) {
+            thresholds.percentile = atof(fraction + 1);
+        }
+    }
+    if ((value = get_option(argc, argv, first, "merge-min-overlap"))) {
+        thresholds.min_overlap = max(1, atoi(value));
+    }
+    return thresholds;
+}
+
+/**
+ * @brief Reads the settings of the pose refinement from the command line.
+ *
+ * --register[=<search(mm)>[,<max yaw(degrees)>]] enables the refinement of the pose of each
+ * image against the combined heightmap before merging it.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param first The index of the first optional argument (after the positional ones).
+ * @return RegistrationOptions The settings, disabled if --register was not given.
+ */
+RegistrationOptions get_registration_options(int argc, char *argv[], int first) {
+    RegistrationOptions options;
+    const char* value = get_option(argc, argv, first, "register");
+    if (value) {
+        options.enabled = true;
+        if (*value) {
+            options.search = max(1.0, atof(value));
+        }
+        const char* yaw = strchr(value, ',');
+        if (yaw) {
+            options.max_yaw = max(0.0, atof(yaw + 1));
+        }
+    }
+    return options;
+}
+
+/**
+ * @brief Reads the settings of the traversability stage from the command line.
+ *
+ * --traversability[=<max slope(degrees)>[,<max step(mm)>[,<max roughness(mm)>]]] enables the
+ * computation of the navigable cells of the combined heightmap.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param first The index of the first optional argument (after the positional ones).
+ * @return TraversabilityOptions The settings, disabled if --traversability was not given.
+ */
+TraversabilityOptions get_traversability_options(int argc, char *argv[], int first) {
+    TraversabilityOptions options;
+    const char* value = get_option(argc, argv, first, "traversability");
+    if (value) {
+        options.enabled = true;
+        if (*value) {
+            options.max_slope = max(0.0, atof(value));
+        }
+        const char* step = strchr(value, ',');
+        if (step) {
+            options.max_step = max(0.0, atof(step + 1));
+            const char* roughness = strchr(step + 1, ',');
+            if (roughness) {
+                options.max_roughness = max(0.0, atof(roughness + 1));
+            }
+        }
+    }
+    return options;
+}
+
+/**
+ * @brief Reads the settings of the fusion from the command line.
+ *
+ * --fuse[=<gate(standard deviations)>] fuses the images into the combined heightmap instead of
+ * merging or rejecting each one whole. The noise model is fitted on
+ * ../data_calibration/params_calibration.txt when it exists.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param first The index of the first optional argument (after the positional ones).
+ * @return FusionOptions The settings, disabled if --fuse was not given.
+ */
+FusionOptions get_fusion_options(int argc, char *argv[], int first) {
+    FusionOptions options;
+    const char* value = get_option(argc, argv, first, "fuse");
+    if (value) {
+        options.enabled = true;
+        if (*value) {
+            options.gate = max(0.0, atof(value));
+        }
+        if (!options.noise.load("../data_calibration/params_calibration.txt")) {
+            printf("No calibration measurements, using the default noise model.\n");
+        }
+        #if DEBUG
+        printf("Noise model: %.1f mm + %.2f mm/m^2 * distance^2\n", options.noise.sigma0, options.noise.quadratic);
+        #endif
+    }
+    return options;
+}
+
+/**
+ * @brief Reads which optional artifacts are written from the command line.
+ *
+ * --export=<artifact>[,<artifact>...] selects the artifacts among depth-csv, depth-png,
+ * camera-points, points-text, heightmap-text, heightmap-png, histogram, ply and pcd, or the
+ * groups text, images, clouds, all and none. Without it the depth CSV and PNG and the heightmap PNGs are
+ * written. --export-text adds the text dumps and --histogram the histogram plot.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param first The index of the first optional argument (after the positional ones).
+ * @return ExportOptions The selected artifacts.
+ */
+ExportOptions get_export_options(int argc, char *argv[], int first) {
+    static const struct {
+        const char* name;
+        unsigned artifacts;
+    } names[] = {
+        { "depth-csv", EXPORT_DEPTH_CSV }, { "depth-png", EXPORT_DEPTH_PNG }, { "camera-points", EXPORT_CAMERA_POINTS },
+        { "points-text", EXPORT_POINTS_TEXT }, { "heightmap-text", EXPORT_HEIGHTMAP_TEXT }, { "heightmap-png", EXPORT_HEIGHTMAP_PNG },
+        { "histogram", EXPORT_HISTOGRAM_PNG }, { "ply", EXPORT_PLY }, { "pcd", EXPORT_PCD }, { "text", EXPORT_TEXT },
+        { "images", EXPORT_IMAGES }, { "clouds", EXPORT_CLOUDS }, { "all", EXPORT_TEXT | EXPORT_IMAGES | EXPORT_CLOUDS }, { "none", 0u }
+    };
+    ExportOptions options;
+    const char* value = get_option(argc, argv, first, "export");
+    if (value) {
+        options.artifacts = 0;
+        while (*value) {
+            size_t length = strcspn(value, ",");
+            bool found = false;
+            for (const auto& entry : names) {
+                if (strlen(entry.name) == length && strncmp(value, entry.name, length) == 0) {
+                    options.artifacts |= entry.artifacts;
+                    found = true;
+                }
+            }
+            if (!found) {
+                cerr << "Unknown artifact: " << string(value, length) << endl;
+            }
+            value += length + (value[length] == ',');
+        }
+    }
+    if (get_option(argc, argv, first, "export-text")) {
+        options.artifacts |= EXPORT_TEXT;
+    }
+    if (get_option(argc, argv, first, "histogram")) {
+        options.artifacts |= EXPORT_HISTOGRAM_PNG;
+    }
+    if (options.artifacts & ~EXPORT_COMPILED) {
+        printf("Some of the selected artifacts are not compiled in (EXPORT_LEVEL %d) and will not be written.\n", EXPORT_LEVEL);
+    }
+    return options;
+}
+
 /**
  * @brief Captures depth frames and accumulates depth data.
  * 
- * This function captures a specified number of depth frames from a RealSense pipeline,
- * normalizes the depth values, and accumulates the depth data. It also counts the number
- * of valid depth measurements for each pixel.
+ * This function reads a specified number of depth frames from a frame source (camera,
+ * .bag recording or raw dump) and accumulates them into per-pixel depth statistics.
+ *
+ * Frames are captured on a dedicated thread and handed over through a bounded ring to the
+ * calling thread, which accumulates each frame split in row bands over options.n_workers
+ * threads (the OpenCV thread count is set to it during the capture). When the source is
+ * live and the ring is full the frame is dropped (and another one is captured in its place),
+ * for recordings the capture thread waits instead.
+ *
+ * In adaptive mode (options.target_stderr > 0) the capture stops before n_index frames once
+ * options.target_fraction of the valid pixels have a standard error of the mean below
+ * options.target_stderr. The convergence is checked every options.check_interval frames
+ * after options.min_frames. The frames of a recording captured past that point are handed
+ * back to the source (see FrameSource::unread()), so a replay gives the same images whatever
+ * the timing of the threads. The frames of a live camera are dropped.
  * 
- * @param pipeline The RealSense pipeline to capture frames from.
- * @param n_index The number of frames to capture.
- * @param accumulated_depth A matrix to accumulate the depth values.
- * @param valid_pixel_count A matrix to count the number of valid depth measurements for each pixel.
- * @param min_dist The minimum distance to consider for depth measurements (in meters).
- * @param max_dist The maximum distance to consider for depth measurements (in meters).
+ * @param source The frame source to capture frames from.
+ * @param n_index The number of frames to capture, or the maximum in adaptive mode.
+ * @param accumulator The per-pixel statistics the frames are accumulated into.
+ * @param options The settings of the capture pipeline.
+ * @param stats If not null, receives the frame, drop, ring occupancy and convergence counters.
  * @return rs2_intrinsics The camera intrinsics of the captured frames.
  */
-rs2_intrinsics get_main_frames_count(pipeline pipeline, int n_index, Mat &accumulated_depth, Mat &valid_pixel_count, int min_dist, int max_dist) {
-    rs2_intrinsics intrinsics;
-    for (int frame_count = 0; frame_count < n_index; ++frame_count) {
-        // Wait for the next set of frames
-        frameset frames = pipeline.wait_for_frames();
-        depth_frame depth_frame = frames.get_depth_frame();
-        intrinsics = depth_frame.get_profile().as<video_stream_profile>().get_intrinsics();
-
-        float depth;
-        Mat depth_data = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
-        // Normalize depth values to max distance (in millimeters)
-        for (int i = 0; i < WIDTH; i++){
-            for (int j = 0; j < HEIGHT; j++){
-                depth = depth_frame.get_distance(i, j)*1000;
-                if (depth >= (float)min_dist) {
-                    if (depth >= (float)max_dist) {
-                        depth_data.at<float>(j, i) = max_dist;
-                    }
-                    else {
-                        depth_data.at<float>(j, i) = depth;
-                    }
-                    valid_pixel_count.at<float>(j, i) += 1;
+rs2_intrinsics get_main_frames_count(FrameSource& source, int n_index, DepthAccumulator& accumulator,
+                                     const CaptureOptions& options, CaptureStats* stats) {
+    FrameRing<DepthFrame> ring(options.ring_capacity);
+    atomic<bool> capture_done(false);
+    atomic<bool> stop_requested(false);
+
+    // Frame read from a recording while the ring was full when the capture was stopped
+    DepthFrame unpushed;
+
+    // Capture thread: pushes n_index frames into the ring
+    thread capture_thread([&]() {
+        DepthFrame frame;
+        bool live = source.is_live();
+        int n_captured = 0;
+        try {
+            while (n_captured < n_index && !stop_requested.load(memory_order_relaxed) && source.next_frame(frame)) {
+                bool pushed = ring.try_push(frame);
+                while (!pushed && !live && !stop_requested.load(memory_order_relaxed)) {
+                    this_thread::yield();
+                    pushed = ring.try_push(frame);
                 }
-                else {
-                    depth_data.at<float>(j, i) = 0;  // Set out-of-range depth to 0
+                if (pushed) {
+                    n_captured++;
+                } else if (live) {
+                    ring.record_drop();
+                } else {
+                    unpushed = std::move(frame);
                 }
             }
+        } catch (const exception& e) {
+            cerr << "Capture stopped: " << e.what() << endl;
+        }
+        capture_done.store(true, memory_order_release);
+    });
+    // Stops and joins the capture thread on every way out, an exception of the accumulation included
+    struct CaptureJoin {
+        atomic<bool>& stop_requested;
+        thread& capture_thread;
+        ~CaptureJoin() {
+            stop_requested.store(true, memory_order_relaxed);
+            if (capture_thread.joinable()) {
+                capture_thread.join();
+            }
+        }
+    } capture_join{ stop_requested, capture_thread };
+
+    // Accumulate the frames as they arrive, one row band per thread
+    ScopedNumThreads threads(options.n_workers);
+    int n_workers = max(1, getNumThreads());
+    bool adaptive = options.target_stderr > 0;
+    double converged_fraction = 0.0;
+    int frame_count = 0;
+    DepthFrame frame;
+    while (!stop_requested.load(memory_order_relaxed)) {
+        if (!ring.try_pop(frame)) {
+            if (capture_done.load(memory_order_acquire) && ring.size() == 0) {
+                break;
+            }
+            this_thread::sleep_for(chrono::microseconds(200));
+            continue;
+        }
+        accumulator.add_frame(frame, n_workers);
+        frame = DepthFrame();
+        frame_count++;
+        if (adaptive && frame_count >= options.min_frames && frame_count % options.check_interval == 0) {
+            converged_fraction = accumulator.converged_fraction(options.target_stderr);
+            if (converged_fraction >= options.target_fraction) {
+                stop_requested.store(true, memory_order_relaxed);
+            }
         }
-        // Accumulate depth data
-        accumulated_depth += depth_data;
     }
-    return intrinsics;
-}
+    stop_requested.store(true, memory_order_relaxed);
+    capture_thread.join();
 
+    // The frames of a recording read ahead of an adaptive stop go back to the source, so the
+    // next image starts right after the last accumulated frame
+    if (!source.is_live()) {
+        vector<DepthFrame> unused;
+        while (ring.try_pop(frame)) {
+            unused.push_back(std::move(frame));
+        }
+        if (unpushed.data) {
+            unused.push_back(std::move(unpushed));
+        }
+        source.unread(unused);
+    }
 
+    if (adaptive) {
+        if (converged_fraction < options.target_fraction) {
+            converged_fraction = accumulator.converged_fraction(options.target_stderr);
+        }
+        printf("Used %d of at most %d frames, %.1f%% of the valid pixels converged.\n", frame_count, n_index, 100.0 * converged_fraction);
+    } else if (frame_count < n_index) {
+        printf("Frame source ended after %d of %d frames.\n", frame_count, n_index);
+    }
+    #if DEBUG
+    printf("Frames: %d, dropped: %llu, peak ring occupancy: %zu/%zu\n", frame_count,
+           (unsigned long long)ring.get_dropped(), ring.get_peak_occupancy(), ring.capacity());
+    #endif
+    if (stats) {
+        stats->frames = frame_count;
+        stats->dropped = ring.get_dropped();
+        stats->peak_occupancy = ring.get_peak_occupancy();
+        stats->converged_fraction = converged_fraction;
+    }
+    return source.get_intrinsics();
+}
 
 /**
  * @brief Deprojects the depth matrix into 3D points.
  * 
- * @param i_filename The input file name to save the 3D coordinates.
  * @param depth_matrix The depth matrix data.
  * @param intrinsics The camera intrinsics.
- * @param image_n The image number.
  * @param min_dist The minimum distance for depth values (in milimiters).
  * @param max_dist The maximum distance for depth values (in milimiters).
- * @return std::vector<Eigen::Vector3f> The 3D points.
+ * @param points Receives the 3D points, in the camera frame.
  */
-vector<Vector3f> deproject_depth_to_3d(const char i_filename[], const Mat &depth_matrix, rs2_intrinsics intrinsics, int image_n, int min_dist, int max_dist) {
-    vector<Eigen::Vector3f> points;
+void deproject_depth_to_3d(const Mat &depth_matrix, rs2_intrinsics intrinsics, int min_dist, int max_dist, PointCloud& points) {
+    shared_ptr<const RayTable> table = get_ray_table(intrinsics);
+    const RayTable& rays = *table;
+    points.resize(WIDTH * HEIGHT);
+    size_t n_points = 0;
     for (int y = 0; y < HEIGHT; ++y) {
+        const float* depth_row = depth_matrix.ptr<float>(y);
+        const float* ray_x = rays.row_x(y);
+        const float* ray_y = rays.row_y(y);
         for (int x = 0; x < WIDTH; ++x) {
-            float depth = depth_matrix.at<float>(y, x);
+            float depth = depth_row[x];
             if (depth > (float)min_dist && depth < (float)max_dist) {
-                float point[3];
-                float pixel[2] = { static_cast<float>(x), static_cast<float>(y) };
-                rs2_deproject_pixel_to_point(point, &intrinsics, pixel, depth);
-                points.emplace_back(point[0], point[1], point[2]);
+                points.x[n_points] = ray_x[x] * depth;
+                points.y[n_points] = ray_y[x] * depth;
+                points.z[n_points] = depth;
+                n_points++;
             }
         }
     }
-    ofstream points_file(i_filename);
-    for (const auto& point : points) {
-        points_file << point[0] << "," << point[1] << "," << point[2] << "\n";
-    }
-    points_file.close();
-    return points;
+    points.resize(n_points);
+    return;
 }
 
+/**
+ * @brief Deprojects the depth matrix straight into world frame points.
+ *
+ * Fuses deproject_depth_to_3d() and transformate_cordinates() in a single pass over the
+ * image, without going through the text files. Each row is processed in two steps: a
+ * branchless loop (which the compiler vectorizes) multiplies the precomputed pixel rays by
+ * the depth, applies M and evaluates the depth range and transformate_cordinates() filters,
+ * then the valid points are compacted into the output columns and the bounds updated.
+ *
+ * @param depth_matrix The depth matrix data.
+ * @param intrinsics The camera intrinsics.
+ * @param min_dist The minimum distance for depth values (in milimiters).
+ * @param max_dist The maximum distance for depth values (in milimiters).
+ * @param M The camera to world transformation matrix.
+ * @param camera_position The camera position vector.
+ * @param points Receives the 3D points, in the world frame.
+ * @param maxAbsX Updated with the maximum absolute value of the world x coordinates.
+ * @param maxAbsY Updated with the maximum absolute value of the world y coordinates.
+ * @param pixels If not null, receives the pixel (y * WIDTH + x) of each point.
+ */
+void deproject_depth_to_world(const Mat &depth_matrix, rs2_intrinsics intrinsics, int min_dist, int max_dist,
+                              const Matrix4d& M, Vector3f camera_position, PointCloud& points, double& maxAbsX, double& maxAbsY,
+                              vector<uint32_t>* pixels) {
+    shared_ptr<const RayTable> table = get_ray_table(intrinsics);
+    const RayTable& rays = *table;
+    const Matrix<float, 3, 4> T = M.topRows<3>().cast<float>();
+    const float min_depth = (float)min_dist;
+    const float max_depth = (float)max_dist;
+    const float max_camera_y = camera_position(2);
+    float world_x[WIDTH], world_y[WIDTH], world_z[WIDTH];
+    uint8_t valid[WIDTH];
+    float max_x = (float)maxAbsX, max_y = (float)maxAbsY;
 
+    points.resize(WIDTH * HEIGHT);
+    if (pixels) {
+        pixels->resize(WIDTH * HEIGHT);
+    }
+    size_t n_points = 0;
+    for (int y = 0; y < HEIGHT; ++y) {
+        const float* depth_row = depth_matrix.ptr<float>(y);
+        const float* ray_x = rays.row_x(y);
+        const float* ray_y = rays.row_y(y);
+        for (int x = 0; x < WIDTH; ++x) {
+            float depth = depth_row[x];
+            float camera_x = ray_x[x] * depth;
+            float camera_y = ray_y[x] * depth;
+            world_x[x] = T(0, 0) * camera_x + T(0, 1) * camera_y + T(0, 2) * depth + T(0, 3);
+            world_y[x] = T(1, 0) * camera_x + T(1, 1) * camera_y + T(1, 2) * depth + T(1, 3);
+            world_z[x] = T(2, 0) * camera_x + T(2, 1) * camera_y + T(2, 2) * depth + T(2, 3);
+            valid[x] = (depth > min_depth) & (depth < max_depth) & (world_y[x] >= 0.0f) & (camera_y <= max_camera_y);
+        }
+        for (int x = 0; x < WIDTH; ++x) {
+            if (valid[x]) {
+                points.x[n_points] = world_x[x];
+                points.y[n_points] = world_y[x];
+                points.z[n_points] = world_z[x];
+                max_x = max(max_x, std::abs(world_x[x]));
+                max_y = max(max_y, std::abs(world_y[x]));
+                if (pixels) {
+                    (*pixels)[n_points] = y * WIDTH + x;
+                }
+                n_points++;
+            }
+        }
+    }
+    points.resize(n_points);
+    if (pixels) {
+        pixels->resize(n_points);
+    }
+    maxAbsX = max_x;
+    maxAbsY = max_y;
+    return;
+}
 
-
+/**
+ * @brief Writes 3D points to a text file, one "x,y,z" line per point.
+ *
+ * @param filename The file to write.
+ * @param points The points.
+ * @param header If true, the camera position and angle lines of the reference_points files are written first.
+ * @param camera_position The camera position vector.
+ * @param camera_angle The camera angle vector.
+ */
+void write_points_to_file(const char filename[], const PointCloud& points, bool header, Vector3f camera_position, Vector3f camera_angle) {
+    ofstream points_file(filename);
+    if (!points_file.is_open()) {
+        cerr << "Error opening file " << filename << endl;
+        return;
+    }
+    if (header) {
+        points_file << camera_position(0) << "," << camera_position(1) << "," << camera_position(2) << "\n";
+        points_file << camera_angle(0) << "," << camera_angle(1) << "," << camera_angle(2) << "\n";
+    }
+    for (size_t i = 0; i < points.size(); ++i) {
+        points_file << points.x[i] << "," << points.y[i] << "," << points.z[i] << "\n";
+    }
+    points_file.close();
+    return;
+}
 
 /**
- * @brief Writes depth data to files and performs transformation.
+ * @brief Processes the captured depth data into world points and writes the image files.
+ *
+ * This function computes the mean depth image, writes it to a CSV file and a PNG file,
+ * reads the camera position and angle, and deprojects the depth image straight into world
+ * frame points. The pose, mean depth, depth variance and points of the image are appended to
+ * the session file, or without one the points are written to the binary point file o_filename
+ * (both are read back by retake). The points are keyed by session_points_key(), which the
+ * grid binned from them is checked against (see append_session_grid()).
  *
- * This function processes depth data by computing the mean depth image, writing it to a CSV file,
- * deprojecting it into 3D points, and writing the depth image to a PNG file. It also creates a 
- * transformation matrix based on camera position and angle, and transforms coordinates accordingly.
+ * The other files are optional (see ExportOptions): the camera frame points as text to
+ * i_filename, and the world frame points as text, PLY or PCD next to o_filename with a .txt,
+ * .ply or .pcd extension. The PLY and PCD points carry the image index and the variance of
+ * the depth of their pixel.
+ *
+ * The files are written by output_writer() in the background, so the function returns as
+ * soon as the points are computed.
  *
  * @param n_index Index of the current dataset.
  * @param image_n Index of the current image.
- * @param i_filename Input filename for depth data.
- * @param o_filename Output filename for transformed coordinates.
+ * @param i_filename Output text filename for the camera frame points (only with EXPORT_CAMERA_POINTS).
+ * @param o_filename Output binary filename for the world frame points, and base name of their optional exports.
  * @param pos_filename Filename for camera position and angle data.
- * @param accumulated_depth Accumulated depth data.
- * @param valid_pixel_count Count of valid pixels in the depth data.
+ * @param accumulator Per-pixel depth statistics of the captured frames.
  * @param intrinsics Camera intrinsics for depth deprojection.
- * @param min_dist Minimum distance for depth values (in meters).
- * @param max_dist Maximum distance for depth values (in meters).
  * @param maxAbsX Maximum absolute X coordinate for transformation.
  * @param maxAbsY Maximum absolute Y coordinate for transformation.
+ * @param camera_position Receives the camera position of the image.
+ * @param camera_angle Receives the camera angle of the image.
+ * @param exports The optional files to write.
+ * @param points Receives the world frame points of the image.
+ * @param session If not null, the session file the records of the image are appended to.
  */
 void write_data_to_files(int n_index, int image_n, const char i_filename[], const char o_filename[], const char pos_filename[],
-                         Mat accumulated_depth, Mat valid_pixel_count, rs2_intrinsics intrinsics, int min_dist, int max_dist, 
-                         double& maxAbsX, double& maxAbsY) {
-
-    // Compute the mean depth image
-    Mat average_depth = get_mean_depth(accumulated_depth, valid_pixel_count, max_dist);
+                         const DepthAccumulator& accumulator, rs2_intrinsics intrinsics, double& maxAbsX, double& maxAbsY,
+                         Vector3f& camera_position, Vector3f& camera_angle, const ExportOptions& exports, PointCloud& points,
+                         SessionWriter* session) {
+    int min_dist = accumulator.get_min_dist();
+    int max_dist = accumulator.get_max_dist();
 
-    // Write the depth data to a CSV file
-    write_depth_to_csv(average_depth, n_index, image_n);
+    // Compute the mean depth image and the per-pixel noise
+    Mat average_depth, depth_variance, valid_ratio;
+    accumulator.finalize(average_depth, depth_variance, valid_ratio);
+    #if DEBUG >= DEBUG_VERBOSE
+    Mat stddev;
+    cv::sqrt(depth_variance, stddev);
+    printf("Mean per-pixel stddev: %.2f mm, mean valid ratio: %.2f\n", cv::mean(stddev, valid_ratio > 0)[0], cv::mean(valid_ratio)[0]);
+    #endif
 
-    // Deproject the mean depth image into 3D points
-    auto points_image = deproject_depth_to_3d(i_filename, average_depth, intrinsics, image_n, min_dist, max_dist);
-
-    // Write the mean depth image to a PNG file
-    write_depth_to_image(average_depth, max_dist, n_index, image_n);
+    // Write the depth data to a CSV file and the mean depth image to a PNG file in the background,
+    // average_depth is not modified after this point so the jobs share it
+    if (exports.enabled(EXPORT_DEPTH_CSV)) {
+        output_writer().submit([average_depth, n_index, image_n]() { write_depth_to_csv(average_depth, n_index, image_n); });
+    }
+    if (exports.enabled(EXPORT_DEPTH_PNG)) {
+        output_writer().submit([average_depth, max_dist, n_index, image_n]() {
+            write_depth_to_image(average_depth, max_dist, n_index, image_n);
+        });
+    }
     // Get the user points for the camera position and angle
     //get_user_points_input(image_n, camera_position, camera_angle);
-    Vector3f camera_position, camera_angle = Vector3f::Zero();
+    camera_angle = Vector3f::Zero();
+    camera_position = Vector3f::Zero();
     get_user_points_file(pos_filename, image_n, camera_position, camera_angle);
     cout << "Camera Position: " << camera_position.transpose() << endl;
     cout << "Camera Angle: " << camera_angle.transpose() << endl;
 
+    if (exports.enabled(EXPORT_CAMERA_POINTS)) {
+        auto camera_points = make_shared<PointCloud>();
+        deproject_depth_to_3d(average_depth, intrinsics, min_dist, max_dist, *camera_points);
+        string filename = i_filename;
+        output_writer().submit([camera_points, filename, camera_position, camera_angle]() {
+            write_points_to_file(filename.c_str(), *camera_points, false, camera_position, camera_angle);
+        });
+    }
 
+    // Deproject the mean depth image straight into world points
     Matrix4d M = create_transformation_matrix(camera_position, camera_angle);
-    transformate_cordinates(i_filename, o_filename, M, maxAbsX, maxAbsY, camera_position, camera_angle);
-    return;
-}
+    bool clouds = exports.enabled(EXPORT_PLY) || exports.enabled(EXPORT_PCD);
+    auto pixels = make_shared<vector<uint32_t>>();
+    deproject_depth_to_world(average_depth, intrinsics, min_dist, max_dist, M, camera_position, points, maxAbsX, maxAbsY,
+                             clouds ? pixels.get() : nullptr);
 
-/**
- * @brief Computes the mean depth for each pixel from accumulated depth values and valid pixel counts.
- *
- * This function calculates the average depth for each pixel by dividing the accumulated depth values
- * by the corresponding valid pixel counts. If a pixel has no valid counts, its average depth remains zero.
- *
- * @param accumulated_depth A matrix of accumulated depth values for each pixel (CV_32FC1).
- * @param valid_pixel_count A matrix of valid pixel counts for each pixel (CV_32SC1).
- * @return A matrix of average depth values for each pixel (CV_32FC1).
- */
-Mat get_mean_depth(Mat accumulated_depth, Mat valid_pixel_count, int max_dist) {
-    Mat average_depth = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
-    float average_depth_point = 0.0f;
-    for (int x = 0; x < accumulated_depth.cols; ++x) {
-        for (int y = 0; y < accumulated_depth.rows; ++y) {
-            if (valid_pixel_count.at<float>(y, x) > 0) {
-                average_depth_point = accumulated_depth.at<float>(y, x) / valid_pixel_count.at<float>(y, x);
-                if (average_depth_point >= 0.99*max_dist){
-                    average_depth.at<float>(y, x) = max_dist; 
-                } else {
-                    average_depth.at<float>(y, x) = accumulated_depth.at<float>(y, x) / valid_pixel_count.at<float>(y, x);
-                }
+    // The caller keeps binning points, the writer gets its own copy
+    shared_ptr<const PointCloud> world_points = make_shared<const PointCloud>(points);
+    string filename = o_filename;
+    if (session) {
+        // The records of the image are indexed together, once they are all written
+        output_writer().submit([session, world_points, average_depth, depth_variance, image_n, camera_position, camera_angle, intrinsics,
+                                min_dist, max_dist]() {
+            SessionPose pose = make_session_pose(camera_position.data(), camera_angle.data(), intrinsics);
+            uint64_t points_key = session_points_key(*world_points, camera_position.data(), camera_angle.data(), min_dist, max_dist);
+            bool written = session->append(SESSION_POSE, image_n, &pose, sizeof(pose)) &&
+                           session->append_matrix(SESSION_MEAN_DEPTH, image_n, average_depth) &&
+                           session->append_matrix(SESSION_DEPTH_VARIANCE, image_n, depth_variance) &&
+                           session->append(SESSION_POINTS, image_n, [&](ostream& file) {
+                               return write_point_file(file, *world_points, POINTS_WORLD, POINTS_FLOAT32, camera_position.data(),
+                                                       camera_angle.data(), intrinsics);
+                           }, points_key);
+            if (written) {
+                session->commit();
             }
-        }
+        });
+    } else {
+        output_writer().submit([world_points, filename, camera_position, camera_angle, intrinsics]() {
+            write_point_file(filename.c_str(), *world_points, POINTS_WORLD, POINTS_FLOAT32, camera_position.data(), camera_angle.data(), intrinsics);
+        });
+    }
+    if (exports.enabled(EXPORT_POINTS_TEXT)) {
+        output_writer().submit([world_points, filename, camera_position, camera_angle]() {
+            write_points_to_file(replace_extension(filename.c_str(), ".txt").c_str(), *world_points, true, camera_position, camera_angle);
+        });
     }
-    return average_depth;
+    if (clouds) {
+        bool ply = exports.enabled(EXPORT_PLY), pcd = exports.enabled(EXPORT_PCD);
+        output_writer().submit([world_points, pixels, depth_variance, filename, image_n, ply, pcd]() {
+            vector<float> variances(pixels->size());
+            const float* variance = depth_variance.ptr<float>();
+            for (size_t i = 0; i < pixels->size(); ++i) {
+                variances[i] = variance[(*pixels)[i]];
+            }
+            if (ply) {
+                write_cloud_file(replace_extension(filename.c_str(), ".ply").c_str(), *world_points, CLOUD_IMAGE | CLOUD_VARIANCE, image_n,
+                                 variances.data());
+            }
+            if (pcd) {
+                write_cloud_file(replace_extension(filename.c_str(), ".pcd").c_str(), *world_points, CLOUD_IMAGE | CLOUD_VARIANCE, image_n,
+                                 variances.data());
+            }
+        });
+    }
+    return;
 }
 
 /**
@@ -367,13 +858,41 @@ Matrix4d translation_matrix(double tx, double ty, double tz) {
  * @param camera_position The camera position vector.
  * @param camera_angle The camera angle vector.
  * 
+ * If the input is a binary point file (see point_file.h) the output is written as a binary point file too.
+ *
  * @throws ios_base::failure If the input file cannot be opened.
  */
 void transformate_cordinates(const char i_filename[],const char o_filename[], Matrix4d M, double& maxAbsX, double& maxAbsY,  Vector3f camera_position, Vector3f camera_angle) {
-    ifstream myin;
+    if (is_point_file(i_filename)) {
+        // Binary point file in, binary point file out
+        MappedPointFile input;
+        if (!input.open(i_filename)) {
+            return;
+        }
+        PointCloud camera_points, world_points;
+        input.read(camera_points);
+        world_points.resize(camera_points.size());
+        size_t n_points = 0;
+        for (size_t i = 0; i < camera_points.size(); ++i) {
+            Vector4d vec(camera_points.x[i], camera_points.y[i], camera_points.z[i], 1.0);
+            Vector4d vec_t = M * vec;
+            if (vec_t(1) >= 0 && vec(1) <= camera_position(2)) {
+                world_points.x[n_points] = vec_t(0);
+                world_points.y[n_points] = vec_t(1);
+                world_points.z[n_points] = vec_t(2);
+                maxAbsX = max(maxAbsX, std::abs(vec_t(0)));
+                maxAbsY = max(maxAbsY, std::abs(vec_t(1)));
+                n_points++;
+            }
+        }
+        world_points.resize(n_points);
+        write_point_file(o_filename, world_points, POINTS_WORLD, (PointEncoding)input.header().encoding,
+                         camera_position.data(), camera_angle.data(), input.intrinsics());
+        return;
+    }
+    TextReader reader;
     try {
-        myin.open(i_filename);
-        if (!myin) {
+        if (!reader.open(i_filename)) {
             throw ios_base::failure("Unable to open input file");
         }
     } catch (const ios_base::failure& e) {
@@ -384,21 +903,17 @@ void transformate_cordinates(const char i_filename[],const char o_filename[], Ma
     myout.open(o_filename);
     myout << camera_position(0) << "," << camera_position(1) << "," << camera_position(2) << endl;
     myout << camera_angle(0) << "," << camera_angle(1) << "," << camera_angle(2) << endl;
-    string line;
-    while (getline(myin, line)) {
-        stringstream ss(line);  
-        string temp;
-        Vector4d vec, vec_t;
-        vec(3)=1;
-        getline(ss, temp, ',');
-        vec(0) = stod(temp); 
-        getline(ss, temp, ',');
-        vec(1) = stod(temp);
-        getline(ss, temp, ',');
-        vec(2) = stod(temp);
-        vec_t = M * vec;
+    const char *line_begin, *line_end;
+    while (reader.next_line(line_begin, line_end)) {
+        double values[3];
+        if (parse_values(line_begin, line_end, values, 3) != 3) {
+            print_invalid_line(line_begin, line_end);
+            continue;
+        }
+        Vector4d vec(values[0], values[1], values[2], 1.0);
+        Vector4d vec_t = M * vec;
         if (vec_t(1) >= 0 && vec(1) <= camera_position(2)){
-            myout << vec_t(0) << "," << vec_t(1) << "," << vec_t(2) << endl;
+            myout << vec_t(0) << "," << vec_t(1) << "," << vec_t(2) << "\n";
             if(std::abs(vec_t(0))>maxAbsX){
                 maxAbsX = std::abs(vec_t(0));
             }
@@ -407,7 +922,6 @@ void transformate_cordinates(const char i_filename[],const char o_filename[], Ma
             }
         }
     }
-    myin.close();
     myout.close();
     return;
 }
@@ -434,72 +948,157 @@ Matrix4d create_transformation_matrix(Vector3f camera_position, Vector3f camera_
 }
 
 /**
- * @brief Populates a matrix with values from a file.
+ * @brief Hands the points of a reference points file over in column blocks.
  *
- * This function reads a file containing x, y, z coordinates and populates the given matrix
- * with the z values. The coordinates are adjusted based on the provided center point and cell dimensions.
- *
- * @param i_filename The path to the input file containing the coordinates.
- * @param matrix The matrix to be populated with z values.
- * @param center_point_row The row index of the center point in the matrix.
- * @param center_point_col The column index of the center point in the matrix.
- * @param cell_dim The dimension of each cell in the matrix.
- * @param n_rows The number of rows in the matrix.
- * @param n_cols The number of columns in the matrix.
+ * Binary point files are memory mapped and their columns passed in place, in their own
+ * encoding. Text files are parsed in blocks of doubles. The first two lines of a text file
+ * are the camera position and angle.
  *
- * The input file should have lines in the format: x,y,z
- * where x, y are coordinates and z is the value to be placed in the matrix.
- * If the coordinates are out of the matrix bounds, an error message is printed.
- * If the z value at a position is greater than the current value or the current value is 0,
- * the matrix is updated with the new z value.
+ * @param i_filename The reference points file, binary or text.
+ * @param process Called with (xs, ys, zs, n_points, camera_position) for each block of points.
+ * @param camera_angle Receives the camera angle stored in the file.
+ * @return Vector3f The camera position stored in the file.
  */
-Vector3f populate_matrix_from_file(const char i_filename[], cv::Mat& matrix, int center_point_row, int center_point_col, int cell_dim, int n_rows, int n_cols) { 
+template <typename Process>
+static Vector3f read_point_columns(const MappedPointFile& file, Process process, Vector3f& camera_angle) {
+    Vector3f camera_position = Vector3f(file.header().camera_position);
+    camera_angle = Vector3f(file.header().camera_angle);
+    if (file.header().encoding == POINTS_FLOAT32) {
+        process(file.float_column(0), file.float_column(1), file.float_column(2), file.size(), camera_position);
+    } else {
+        process(file.int16_column(0), file.int16_column(1), file.int16_column(2), file.size(), camera_position);
+    }
+    return camera_position;
+}
+
+template <typename Process>
+static Vector3f read_point_columns(const char i_filename[], Process process, Vector3f& camera_angle) {
     Vector3f camera_position = Vector3f::Zero();
-    ifstream file(i_filename);
-    if (!file.is_open()) {
+    camera_angle = Vector3f::Zero();
+    if (is_point_file(i_filename)) {
+        MappedPointFile file;
+        if (!file.open(i_filename)) {
+            return camera_position;
+        }
+        return read_point_columns(file, process, camera_angle);
+    }
+    TextReader reader;
+    if (!reader.open(i_filename)) {
         cerr << "Error opening file!" << endl;
         return camera_position;
     }
-    int row, col;
-    int z_value;
-    string line;
-    // Ignore the first two lines
-    getline(file, line);
-    stringstream ss_position(line);
-    ss_position >> camera_position(0);
-    ss_position.ignore(1);
-    ss_position >> camera_position(1);
-    ss_position.ignore(1);
-    ss_position >> camera_position(2);
-
-    getline(file, line);
-    int err = 0;
-    double x, y, z;
-    while (getline(file, line)) {
-        istringstream iss(line);
-        char comma1, comma2;
-        if (!(iss >> x >> comma1 >> y >> comma2 >> z) || comma1 != ',' || comma2 != ',') {
-            cerr << "Invalid line format: " << line << endl;
+    const char *line_begin, *line_end;
+    double values[3];
+    if (reader.next_line(line_begin, line_end) && parse_values(line_begin, line_end, values, 3) == 3) {
+        camera_position = Vector3f(values[0], values[1], values[2]);
+    }
+    if (reader.next_line(line_begin, line_end) && parse_values(line_begin, line_end, values, 3) == 3) {
+        camera_angle = Vector3f(values[0], values[1], values[2]);
+    }
+    const size_t block = 4096;
+    vector<double> xs(block), ys(block), zs(block);
+    size_t n_points = 0;
+    while (reader.next_line(line_begin, line_end)) {
+        if (parse_values(line_begin, line_end, values, 3) != 3) {
+            print_invalid_line(line_begin, line_end);
             continue;
         }
-        col = center_point_col + static_cast<int>(floor(x / cell_dim));
-        row = center_point_row - static_cast<int>(floor(y / cell_dim));
+        xs[n_points] = values[0];
+        ys[n_points] = values[1];
+        zs[n_points] = values[2];
+        if (++n_points == block) {
+            process(xs.data(), ys.data(), zs.data(), n_points, camera_position);
+            n_points = 0;
+        }
+    }
+    process(xs.data(), ys.data(), zs.data(), n_points, camera_position);
+    return camera_position;
+}
 
-        if (row >= 0 && row <= n_rows && col >= 0 && col <= n_cols) {
-            z_value = z;
-            if(matrix.at<int>(row, col) < z_value || matrix.at<int>(row, col) == 0){
-                if(abs(z_value) > MAX_ERROR){
-                    matrix.at<int>(row, col) = z_value;
-                }
+// Returns the function binning the point columns of read_point_columns() into a heightmap
+static auto heightmap_binner(TiledHeightmap& heightmap, int n_workers, const NoiseModel* noise, vector<float>& weights) {
+    return [&heightmap, n_workers, noise, &weights](const auto* xs, const auto* ys, const auto* zs, size_t n_points, const Vector3f& camera_position) {
+        if constexpr (is_same<decltype(xs), const float*>::value) {
+            if (noise) {
+                noise->point_weights(xs, ys, zs, n_points, camera_position, weights);
             }
+            heightmap.add_points(xs, ys, zs, n_points, n_workers, noise ? weights.data() : nullptr);
         } else {
-            cerr << "Coordinates (" << x << ", " << y << ") out of matrix bounds. (row: " << row << " col: " << col << ")" << endl;
+            for (size_t i = 0; i < n_points; ++i) {
+                float x = xs[i], y = ys[i], z = zs[i];
+                Vector3f offset = Vector3f(x, y, z) - camera_position;
+                heightmap.add_point(x, y, z, noise ? noise->weight(offset.squaredNorm()) : 0.0f);
+            }
         }
+    };
+}
+
+/**
+ * @brief Bins the points of a reference points file into a tiled heightmap.
+ *
+ * @param i_filename The reference points file, binary or text (see read_point_columns()).
+ * @param heightmap The heightmap the points are added to.
+ * @param n_workers The number of threads binning float point files, 0 uses the OpenCV thread count.
+ * @param noise If not null, the points are also fused, weighted by this noise model.
+ * @param camera_angle If not null, receives the camera angle stored in the file.
+ * @return Vector3f The camera position stored in the file.
+ */
+Vector3f populate_heightmap_from_file(const char i_filename[], TiledHeightmap& heightmap, int n_workers, const NoiseModel* noise,
+                                      Vector3f* camera_angle) {
+    vector<float> weights;
+    Vector3f angle;
+    Vector3f camera_position = read_point_columns(i_filename, heightmap_binner(heightmap, n_workers, noise, weights), angle);
+    if (camera_angle) {
+        *camera_angle = angle;
+    }
+    return camera_position;
+}
+
+/**
+ * @brief Bins the points of a mapped point file, or of a session record, into a tiled heightmap.
+ *
+ * @param file The points.
+ * @param heightmap The heightmap the points are added to.
+ * @param n_workers The number of threads binning float points, 0 uses the OpenCV thread count.
+ * @param noise If not null, the points are also fused, weighted by this noise model.
+ * @param camera_angle If not null, receives the camera angle stored with the points.
+ * @return Vector3f The camera position stored with the points.
+ */
+Vector3f populate_heightmap_from_file(const MappedPointFile& file, TiledHeightmap& heightmap, int n_workers, const NoiseModel* noise,
+                                      Vector3f* camera_angle) {
+    vector<float> weights;
+    Vector3f angle;
+    Vector3f camera_position = read_point_columns(file, heightmap_binner(heightmap, n_workers, noise, weights), angle);
+    if (camera_angle) {
+        *camera_angle = angle;
     }
-    file.close();
     return camera_position;
 }
 
+/**
+ * @brief Appends the grid binned from the points of an image to the session file, and commits it.
+ *
+ * The grid is keyed by session_grid_key() of the key of the points of the image, read from
+ * the index of the session, so the points must be appended first. retake reuses the grid
+ * instead of binning the points again as long as the key matches.
+ *
+ * @param session The session file.
+ * @param image_n The image.
+ * @param heightmap The heightmap binned from the points of the image alone, before any registration.
+ * @param camera_position The camera position of the image.
+ * @param camera_angle The camera angle of the image.
+ * @param noise The noise model the points were weighted by, null if they were not.
+ * @return true if the grid was written.
+ */
+bool append_session_grid(SessionWriter& session, int image_n, const TiledHeightmap& heightmap, const Vector3f& camera_position,
+                         const Vector3f& camera_angle, const NoiseModel* noise) {
+    uint64_t key = session_grid_key(session.key(SESSION_POINTS, image_n), heightmap.get_cell_dim(), noise);
+    bool written = session.append(SESSION_GRID, image_n, [&](ostream& file) {
+        return write_heightmap_state(file, heightmap, camera_position.data(), camera_angle.data());
+    }, key);
+    return written && session.commit();
+}
+
 /**
  * @brief Saves the given matrix to a file with zeros and returns the maximum value in the matrix.
  *
@@ -538,40 +1137,6 @@ void save_matrix_with_zeros(const Mat& mat, const std::string& filename, int n_r
 }
 
 
-/**
- * @brief Compares two matrices and checks if the average root of the squared differences 
- *        of their non-zero elements is less than a given threshold.
- * 
- * @param matrix1 The first matrix to compare (cv::Mat).
- * @param matrix2 The second matrix to compare (cv::Mat).
- * @param n_rows The number of rows in the matrices.
- * @param n_cols The number of columns in the matrices.
- * @param e The threshold value for comparison.
- * @return true if the average root of the squared differences is less than the threshold, false otherwise.
- */
-bool check_matrix(const Mat& matrix1, const Mat& matrix2, int n_rows, int n_cols, int e) {
-    int n = 0, temp_val1 = 0, temp_val2 = 0;
-    int squared_sum = 0;
-    for (int i = 0; i < n_rows; i++) {
-        for (int j = 0; j < n_cols; j++) {
-            temp_val1 = matrix1.at<int>(i, j);
-            temp_val2 = matrix2.at<int>(i, j);
-            if(temp_val1 != 0 && temp_val2 != 0) {
-                n += 1;
-                squared_sum += std::abs(std::pow(temp_val1,2) - std::pow(temp_val2,2));
-                //cout << "Value original: " << temp_val1 << " Value transformed: " << temp_val2 << endl;
-            }
-        }
-    }
-    squared_sum = std::sqrt(squared_sum);
-    cout << "Squared sum: " << squared_sum/n << " Error: " << e << endl;
-    if(squared_sum/n < e){
-        return true;
-    }
-    return false;
-}
-
-
 /**
  * @brief Normalizes and inverts a CV_32SC1 matrix for visualization.
  *
@@ -9,6 +9,26 @@
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 #include <fstream>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "frame_source.h"
+#include "frame_ring.h"
+#include "depth_accumulator.h"
+#include "point_cloud.h"
+#include "point_file.h"
+#include "text_reader.h"
+#include "similarity.h"
+#include "heightmap.h"
+#include "heightmap_file.h"
+#include "registration.h"
+#include "traversability.h"
+#include "fusion.h"
+#include "map_stats.h"
+#include "async_writer.h"
+#include "cloud_export.h"
+#include "session.h"
 
 // #define WIDTH 640
 // #define HEIGHT 480
@@ -20,22 +40,122 @@
 
 #define MAX_ERROR 5
 
-#define DEBUG 1
+// Diagnostic messages compiled in, override with -DDEBUG=<level>
+#define DEBUG_NONE 0
+#define DEBUG_SUMMARY 1   // One line per image or stage: device, frames, registration, timings
+#define DEBUG_VERBOSE 2   // Also the statistics that need an extra pass over an image
+#ifndef DEBUG
+#define DEBUG DEBUG_SUMMARY
+#endif
+
+// Optional artifacts compiled in, override with -DEXPORT_LEVEL=<level>: 0 none, 1 the PNG images and the PLY/PCD point
+// clouds, 2 also the CSV and text dumps
+#ifndef EXPORT_LEVEL
+#define EXPORT_LEVEL 2
+#endif
 
 using namespace Eigen;
 using namespace std;
 using namespace rs2;
 using namespace cv;
 
+/**
+ * @brief Sets the number of threads of the OpenCV thread pool while in scope.
+ *
+ * parallel_for_() only takes the number of stripes the work is split in, the threads running
+ * them are those of the global pool, so the --workers count is applied through this.
+ */
+class ScopedNumThreads {
+public:
+    // n_threads 0 keeps the current count
+    explicit ScopedNumThreads(int n_threads) : previous(getNumThreads()) {
+        if (n_threads > 0 && n_threads != previous) {
+            setNumThreads(n_threads);
+        }
+    }
+    ~ScopedNumThreads() {
+        if (getNumThreads() != previous) {
+            setNumThreads(previous);
+        }
+    }
+    ScopedNumThreads(const ScopedNumThreads&) = delete;
+    ScopedNumThreads& operator=(const ScopedNumThreads&) = delete;
+
+private:
+    int previous;
+};
+
+// Settings of the capture/accumulate pipeline
+struct CaptureOptions {
+    int n_workers = 0;          // Threads accumulating each frame, 0 uses the OpenCV thread count
+    int ring_capacity = 16;     // Frames that can wait between the capture and the accumulation
+    TemporalEstimator estimator = ESTIMATOR_MEAN;  // Estimator of the depth of each pixel
+    double target_stderr = 0.0;  // Adaptive mode: standard error of the mean to reach (mm), 0 disables it
+    double target_fraction = 0.95;  // Adaptive mode: fraction of the valid pixels that must reach it
+    int min_frames = 30;        // Adaptive mode: frames captured before checking the convergence
+    int check_interval = 10;    // Adaptive mode: frames between two convergence checks
+};
+
+// What happened during one call to get_main_frames_count()
+struct CaptureStats {
+    int frames = 0;             // Frames accumulated
+    uint64_t dropped = 0;       // Frames discarded because the ring was full
+    size_t peak_occupancy = 0;  // Highest number of frames waiting in the ring
+    double converged_fraction = 0.0;  // Adaptive mode: fraction of the valid pixels that converged
+};
+
+// Optional artifacts of a run, the session file, heightmap files and map statistics are always written
+enum ExportArtifact : unsigned {
+    EXPORT_DEPTH_CSV = 1u << 0,       // data/mean<n>_depth<i>.csv
+    EXPORT_DEPTH_PNG = 1u << 1,       // data/mean<n>_depth_image<i>.png
+    EXPORT_CAMERA_POINTS = 1u << 2,   // data/camera_points_image<i>.txt
+    EXPORT_POINTS_TEXT = 1u << 3,     // data/reference_points_image<i>.txt
+    EXPORT_HEIGHTMAP_TEXT = 1u << 4,  // data/deprojected_points<i>.txt and data/combinated_deprojected_points.txt
+    EXPORT_HEIGHTMAP_PNG = 1u << 5,   // data/deprojected_image<i>.png and data/combinated_deprojected_image.png
+    EXPORT_HISTOGRAM_PNG = 1u << 6,   // data/histogram.png
+    EXPORT_PLY = 1u << 7,             // data/reference_points_image<i>.ply
+    EXPORT_PCD = 1u << 8              // data/reference_points_image<i>.pcd
+};
+#define EXPORT_IMAGES (EXPORT_DEPTH_PNG | EXPORT_HEIGHTMAP_PNG | EXPORT_HISTOGRAM_PNG)
+#define EXPORT_CLOUDS (EXPORT_PLY | EXPORT_PCD)
+#define EXPORT_TEXT (EXPORT_DEPTH_CSV | EXPORT_CAMERA_POINTS | EXPORT_POINTS_TEXT | EXPORT_HEIGHTMAP_TEXT)
+#if EXPORT_LEVEL >= 2
+#define EXPORT_COMPILED (EXPORT_IMAGES | EXPORT_CLOUDS | EXPORT_TEXT)
+#elif EXPORT_LEVEL == 1
+#define EXPORT_COMPILED (EXPORT_IMAGES | EXPORT_CLOUDS)
+#else
+#define EXPORT_COMPILED 0u
+#endif
+
+// Artifacts selected on the command line
+struct ExportOptions {
+    unsigned artifacts = EXPORT_DEPTH_CSV | EXPORT_DEPTH_PNG | EXPORT_HEIGHTMAP_PNG;
+    // Constant false for the artifacts that are not compiled in, so their code is removed
+    bool enabled(unsigned artifact) const { return (EXPORT_COMPILED & artifact) && (artifacts & artifact); }
+};
+
 // Function declarations
-rs2_intrinsics get_main_frames_count(pipeline pipeline, int n_index, Mat &accumulated_depth, Mat &valid_pixel_count, int min_dist, int max_dist);
+const char* get_option(int argc, char *argv[], int first, const char name[]);
+string replace_extension(const char filename[], const char extension[]);
+CaptureOptions get_capture_options(int argc, char *argv[], int first);
+SimilarityThresholds get_similarity_thresholds(int argc, char *argv[], int first);
+RegistrationOptions get_registration_options(int argc, char *argv[], int first);
+TraversabilityOptions get_traversability_options(int argc, char *argv[], int first);
+FusionOptions get_fusion_options(int argc, char *argv[], int first);
+ExportOptions get_export_options(int argc, char *argv[], int first);
+rs2_intrinsics get_main_frames_count(FrameSource& source, int n_index, DepthAccumulator& accumulator,
+                                     const CaptureOptions& options = CaptureOptions(), CaptureStats* stats = nullptr);
 void write_data_to_files(int n_index, int image_n, const char i_filename[], const char o_filename[], const char pos_filename[],
-                         Mat accumulated_depth, Mat valid_pixel_count, rs2_intrinsics intrinsics, int min_dist, int max_dist, 
-                         double& maxAbsX, double& maxAbsY);
+                         const DepthAccumulator& accumulator, rs2_intrinsics intrinsics, double& maxAbsX, double& maxAbsY,
+                         Vector3f& camera_position, Vector3f& camera_angle, const ExportOptions& exports, PointCloud& points,
+                         SessionWriter* session = nullptr);
 
 void write_depth_to_csv(const Mat &depth_matrix, int n_index, int image_n);
-vector<Vector3f> deproject_depth_to_3d(const char i_filename[], const Mat &depth_matrix, rs2_intrinsics intrinsics, int image_n, int min_dist, int max_dist);
-Mat get_mean_depth(Mat accumulated_depth, Mat valid_pixel_count, int max_dist);
+void deproject_depth_to_3d(const Mat &depth_matrix, rs2_intrinsics intrinsics, int min_dist, int max_dist, PointCloud& points);
+void deproject_depth_to_world(const Mat &depth_matrix, rs2_intrinsics intrinsics, int min_dist, int max_dist,
+                              const Matrix4d& M, Vector3f camera_position, PointCloud& points, double& maxAbsX, double& maxAbsY,
+                              vector<uint32_t>* pixels = nullptr);
+void write_points_to_file(const char filename[], const PointCloud& points, bool header, Vector3f camera_position, Vector3f camera_angle);
 void write_depth_to_image(const Mat &depth_matrix, int max_depth, int n_index, int image_n);
 void get_user_points_input(int image_n, Vector3f &camera_position, Vector3f &camera_angle);
 void get_user_points_file(const char pos_filename[], int image_n, Vector3f &camera_position, Vector3f &camera_angle);
@@ -46,8 +166,12 @@ void transformate_cordinates(const char i_filename[],const char o_filename[], Ma
 Matrix4d create_transformation_matrix(Vector3f camera_position, Vector3f camera_angle);
 
 
-Vector3f populate_matrix_from_file(const char i_filename[], cv::Mat& matrix, int center_point_row, int center_point_col, int cell_dim, int n_rows, int n_cols);
-bool check_matrix(const Mat& matrix1, const Mat& matrix2, int n_rows, int n_cols, int e);
+Vector3f populate_heightmap_from_file(const char i_filename[], TiledHeightmap& heightmap, int n_workers = 0, const NoiseModel* noise = nullptr,
+                                      Vector3f* camera_angle = nullptr);
+Vector3f populate_heightmap_from_file(const MappedPointFile& file, TiledHeightmap& heightmap, int n_workers = 0, const NoiseModel* noise = nullptr,
+                                      Vector3f* camera_angle = nullptr);
+bool append_session_grid(SessionWriter& session, int image_n, const TiledHeightmap& heightmap, const Vector3f& camera_position,
+                         const Vector3f& camera_angle, const NoiseModel* noise = nullptr);
 void save_matrix_with_zeros(const Mat& mat, const std::string& filename, int n_rows, int n_cols, Vector3f camera_position);
 void normalizeAndInvert(const Mat& input, Mat& output);
 #endif // RESOURCES_H
@@ -8,8 +8,8 @@
 
 // Main function
 int main(int argc, char *argv[]) {
-    if (argc != 7) {
-        printf("Usage: %s <number of images total> <minimum distance(mm)> <maximum distance(mm)> <number of frames> <cell discretization(mm)> <image to retake>\n", argv[0]);
+    if (argc < 7) {
+        printf("Usage: %s <number of images total> <minimum distance(mm)> <maximum distance(mm)> <number of frames> <cell discretization(mm)> <image to retake> [--source=<file.bag|raw Z16 dump>] [--workers=<n>] [--ring=<frames>] [--estimator=<mean|median|trimmed|mode>] [--adaptive=<stderr(mm)>[,<fraction>]] [--min-frames=<n>] [--merge-rmse=<mm>] [--merge-mad=<mm>] [--merge-percentile=<mm>[,<fraction>]] [--merge-min-overlap=<cells>] [--register[=<search(mm)>[,<max yaw(deg)>]]] [--traversability[=<max slope(deg)>[,<max step(mm)>[,<max roughness(mm)>]]]] [--fuse[=<gate(std devs)>]] [--export=<artifact>[,<artifact>...]] [--histogram] [--export-text]\n", argv[0]);
         return EXIT_FAILURE;
     }
     int n_images = atoi(argv[1]);
@@ -22,26 +22,50 @@ int main(int argc, char *argv[]) {
     double maxAbsX=0;
     double maxAbsY=0;
 
-    int center_x;
-    int center_y;
+    // Heightmap and camera pose of each image, and the combined heightmap
+    vector<TiledHeightmap> image_heightmaps;
+    vector<Vector3f> camera_positions;
+    vector<Vector3f> camera_angles;
+    TiledHeightmap big_heightmap_combined(cell_dim);
+    ExportOptions exports = get_export_options(argc, argv, 7);
 
-    vector<string> filenames;
-
-    // Initialize RealSense pipeline
-    pipeline pipeline;
-    config config;
-    config.enable_stream(RS2_STREAM_DEPTH, WIDTH, HEIGHT, RS2_FORMAT_Z16, FPS);
-    pipeline.start(config);
-    device dev = pipeline.get_active_profile().get_device();
-    if (!dev) {
-        printf("No device found.\n");
+    // Initialize the frame source (RealSense camera, .bag recording or raw dump)
+    unique_ptr<FrameSource> source = open_frame_source(get_option(argc, argv, 7, "source"));
+    if (!source) {
         return EXIT_FAILURE;
-    } else {
-        #if DEBUG
-        printf("Device found.\n");
-        #endif
+    }
+    CaptureOptions capture_options = get_capture_options(argc, argv, 7);
+    SimilarityThresholds merge_thresholds = get_similarity_thresholds(argc, argv, 7);
+    RegistrationOptions registration = get_registration_options(argc, argv, 7);
+    TraversabilityOptions traversability = get_traversability_options(argc, argv, 7);
+    FusionOptions fusion = get_fusion_options(argc, argv, 7);
+
+    // The records of the images are read from the session file, the retaken image is appended to it.
+    // Only sessions saved before the session file are read from the point files.
+    SessionFile session_file;
+    SessionWriter session;
+    if (session_file.open("../data/session.dss")) {
+        // The images of the session are merged with the retaken one, they must share the cells
+        if (session_file.header().cell_dim != cell_dim) {
+            cerr << "The session was captured with cells of " << session_file.header().cell_dim << " mm, not " << cell_dim << " mm" << endl;
+            return EXIT_FAILURE;
+        }
+        if (!session.open("../data/session.dss")) {
+            return EXIT_FAILURE;
+        }
+        // Every other image must be in the session, the loose files in ../data may be from an older session
+        for (int image_n = 0; image_n < n_images; image_n++) {
+            MappedPointFile session_points;
+            if (image_n != image_to_retake && !session_file.points(image_n, session_points)) {
+                cerr << "Image " << image_n << " is missing from the session file" << endl;
+                return EXIT_FAILURE;
+            }
+        }
     }
 
+    const NoiseModel* noise = fusion.enabled ? &fusion.noise : nullptr;
+    int n_reused = 0;
+
     // Get depth intrinsics
     rs2_intrinsics intrinsics;
     
@@ -59,107 +83,167 @@ int main(int argc, char *argv[]) {
     for (int image_n = 0; image_n < n_images; image_n++) {
         
         char o_filename[100];
-        sprintf(o_filename, "../data/reference_points_image%d.txt", image_n);
-        filenames.push_back(o_filename);
+        sprintf(o_filename, "../data/reference_points_image%d.bin", image_n);
+        if (image_n != image_to_retake && !ifstream(o_filename)) {
+            // Sessions saved before the binary point files only have the text file
+            sprintf(o_filename, "../data/reference_points_image%d.txt", image_n);
+        }
+        image_heightmaps.emplace_back(cell_dim);
+        Vector3f camera_position, camera_angle;
+        PointCloud points;
+        MappedPointFile session_points;
 
         if(image_n == image_to_retake){
     
-            // Reinitialize OpenCV matrices to accumulate depth data
-            Mat accumulated_depth = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
-            Mat valid_pixel_count = Mat::zeros(HEIGHT, WIDTH, CV_32FC1);
+            // Per-pixel statistics of the frames of this image
+            DepthAccumulator accumulator(min_dist, max_dist, capture_options.estimator);
             
-            intrinsics = get_main_frames_count(pipeline, n_index, accumulated_depth, valid_pixel_count, min_dist, max_dist);
+            intrinsics = get_main_frames_count(*source, n_index, accumulator, capture_options);
             //aqui va too       
 
             char i_filename[100];
             sprintf(i_filename, "../data/camera_points_image%d.txt", image_n);
             char pos_filename[100];
             sprintf(pos_filename, "../position_camera.txt");
-            write_data_to_files(n_index, image_n, i_filename, o_filename, pos_filename, accumulated_depth, valid_pixel_count, intrinsics, min_dist, max_dist, maxAbsX, maxAbsY);
-            
+            write_data_to_files(n_index, image_n, i_filename, o_filename, pos_filename, accumulator, intrinsics, maxAbsX, maxAbsY, camera_position, camera_angle, exports, points,
+                                session.is_open() ? &session : nullptr);
+            vector<float> weights;
+            if (fusion.enabled) {
+                fusion.noise.point_weights(points, camera_position, weights);
+            }
+            image_heightmaps.back().add_points(points, capture_options.n_workers, fusion.enabled ? weights.data() : nullptr);
+            if (session.is_open()) {
+                // Queued after the points of the image, whose key the grid is keyed by
+                auto grid = make_shared<const TiledHeightmap>(image_heightmaps.back());
+                output_writer().submit([&session, grid, image_n, camera_position, camera_angle, noise]() {
+                    append_session_grid(session, image_n, *grid, camera_position, camera_angle, noise);
+                });
+            }
             
             cout << "Image " << image_n << " updated. Altike Mi rey." << endl;
         }
-        else{
-            ifstream myin(o_filename);
-            string line;
-            int line_count = 0;
-            while (getline(myin, line)) {
-                line_count++;
-                if (line_count <= 2) continue; // Ignore the first 2 lines
-                stringstream ss(line);  
-                string temp;
-                getline(ss, temp, ',');
-                double x = stod(temp); 
-                getline(ss, temp, ',');
-                double y = stod(temp);
-                getline(ss, temp, ',');
-                double z = stod(temp);
-                if(std::abs(x) > maxAbsX){
-                    maxAbsX = std::abs(x);
-                }
-                if(std::abs(y) > maxAbsY){
-                    maxAbsY = std::abs(y);
-                }
+        else if (session_file.points(image_n, session_points)) {
+            // The cached grid is only reused if it was binned from the same points with the same settings
+            MappedHeightmapFile grid;
+            uint64_t grid_key = session_grid_key(session_file.key(SESSION_POINTS, image_n), cell_dim, noise);
+            if (grid_key != 0 && session_file.key(SESSION_GRID, image_n) == grid_key && session_file.grid(image_n, grid) &&
+                read_heightmap_state(grid, image_heightmaps.back())) {
+                camera_position = Vector3f(grid.header().camera_position);
+                camera_angle = Vector3f(grid.header().camera_angle);
+                n_reused++;
+            } else {
+                camera_position = populate_heightmap_from_file(session_points, image_heightmaps.back(), capture_options.n_workers, noise, &camera_angle);
+                // Queued behind the records of the retaken image, so a commit never indexes only some of them
+                auto grid = make_shared<const TiledHeightmap>(image_heightmaps.back());
+                output_writer().submit([&session, grid, image_n, camera_position, camera_angle, noise]() {
+                    append_session_grid(session, image_n, *grid, camera_position, camera_angle, noise);
+                });
             }
-            myin.close();
+        }
+        else{
+            camera_position = populate_heightmap_from_file(o_filename, image_heightmaps.back(), capture_options.n_workers,
+                                                           fusion.enabled ? &fusion.noise : nullptr, &camera_angle);
+        }
+        camera_positions.push_back(camera_position);
+        camera_angles.push_back(camera_angle);
+
+        // Merge the image into the combined heightmap, without binning it again
+        if (!merge_heightmap(big_heightmap_combined, image_heightmaps.back(), merge_thresholds, &registration, &fusion)) {
+            cout << "Images too diferent to be merged" << endl;
+        } else if (image_n > 0) {
+            cout << "Image " << image_n << " merged" << endl;
         }
     }
-    // Stop the pipeline
-    pipeline.stop();
-    
-    int num_rows = (ceil((maxAbsY) / cell_dim))+1;
-    int num_cols = (ceil((2 * maxAbsX) / cell_dim))+1;
+    // Stop the frame source and wait for the files of the images
+    source->stop();
+    output_writer().flush();
+    #if DEBUG
+    printf("Output writer stalls: %llu\n", (unsigned long long)output_writer().get_stalls());
+    printf("Cached grids reused: %d of %d\n", n_reused, n_images - 1);
+    #endif
     
-    center_y = num_rows;
-    center_x = num_cols / 2;
-
-    int e = 20;
-    cout << "Num Cols: " << num_cols << endl;
-    cout << "Num Rows: " << num_rows << endl;
+    if (n_images == 1) {
+        cout << "Only one image" << endl;
+    }
 
-    Vector3f o_camera_position;
-    Mat big_matrix_combined = Mat::zeros(num_rows, num_cols, CV_32SC1);
-    o_camera_position = populate_matrix_from_file(filenames[0].c_str(), big_matrix_combined, center_y, center_x, cell_dim, num_rows, num_cols);
-    
-    Mat big_matrix_combined1_photo = big_matrix_combined.clone();
+    // The dense outputs of all the images share the layout of the observed area
+    HeightmapLayout layout = big_heightmap_combined.layout();
+    for (const TiledHeightmap& heightmap : image_heightmaps) {
+        layout = merge_layouts(layout, heightmap.layout());
+    }
+    cout << "Num Cols: " << layout.n_cols << endl;
+    cout << "Num Rows: " << layout.n_rows << endl;
+
+    // Layers of the heightmap files
+    vector<HeightmapLayer> layers = { HEIGHTMAP_MAX, HEIGHTMAP_MIN, HEIGHTMAP_MEAN, HEIGHTMAP_COUNT, HEIGHTMAP_VARIANCE };
+    if (fusion.enabled) {
+        layers.push_back(HEIGHTMAP_FUSED);
+        layers.push_back(HEIGHTMAP_FUSED_VARIANCE);
+    }
 
-    save_matrix_with_zeros(big_matrix_combined1_photo, "../data/deprojected_points0.txt", num_rows, num_cols, o_camera_position);
-    Mat output;
-    normalizeAndInvert(big_matrix_combined1_photo, output);
-    imwrite("../data/deprojected_image0.png", output);
-    
+    Mat matrix, output;
     char deprojected_filename[100];
-    if(n_images != 1){
-        for(int n_image = 1; n_image < n_images; n_image++){
-            Mat matrix_to_be_merged = Mat::zeros(num_rows, num_cols, CV_32SC1);
-            Vector3f camera_position = camera_position = populate_matrix_from_file(filenames[n_image].c_str(), matrix_to_be_merged, center_y, center_x, cell_dim, num_rows, num_cols);
-            Mat big_matrix_combined2_photo = matrix_to_be_merged.clone();
+    for (int n_image = 0; n_image < n_images; n_image++) {
+        sprintf(deprojected_filename, "../data/heightmap_image%d.dhm", n_image);
+        write_heightmap_file(deprojected_filename, image_heightmaps[n_image], layout, layers, HEIGHTMAP_TILED, camera_positions[n_image].data(),
+                             camera_angles[n_image].data());
+        if (!exports.enabled(EXPORT_HEIGHTMAP_TEXT | EXPORT_HEIGHTMAP_PNG)) {
+            continue;
+        }
+        image_heightmaps[n_image].to_mat(layout, matrix);
+        if (exports.enabled(EXPORT_HEIGHTMAP_TEXT)) {
             sprintf(deprojected_filename, "../data/deprojected_points%d.txt", n_image);
-            save_matrix_with_zeros(big_matrix_combined2_photo, deprojected_filename, num_rows, num_cols, camera_position);
-            normalizeAndInvert(big_matrix_combined2_photo, output);
+            save_matrix_with_zeros(matrix, deprojected_filename, layout.n_rows, layout.n_cols, camera_positions[n_image]);
+        }
+        if (exports.enabled(EXPORT_HEIGHTMAP_PNG)) {
+            normalizeAndInvert(matrix, output);
             sprintf(deprojected_filename, "../data/deprojected_image%d.png", n_image);
             imwrite(deprojected_filename, output);
-            
-
-            if(check_matrix(big_matrix_combined, matrix_to_be_merged, num_rows, num_cols, e)){
-                populate_matrix_from_file(filenames[n_image].c_str(), big_matrix_combined, center_y, center_x, cell_dim, num_rows, num_cols);
-                cout << "Image " << n_image << " merged" << endl;
-            }
-            else{
-                cout << "Images too diferent to be merged" << endl;
-            }
         }
     }
-    else{
-        cout << "Only one image" << endl;
+
+    write_heightmap_file("../data/combinated_heightmap.dhm", big_heightmap_combined, layout, layers, HEIGHTMAP_TILED, camera_positions[0].data(),
+                         camera_angles[0].data());
+    if (exports.enabled(EXPORT_HEIGHTMAP_TEXT | EXPORT_HEIGHTMAP_PNG)) {
+        if (fusion.enabled) {
+            // The fused heights, rounded to the millimeter like the other dumps
+            Mat fused;
+            big_heightmap_combined.to_mat(layout, fused, HEIGHTMAP_FUSED);
+            fused.convertTo(matrix, CV_32S);
+        } else {
+            big_heightmap_combined.to_mat(layout, matrix);
+        }
+        if (exports.enabled(EXPORT_HEIGHTMAP_TEXT)) {
+            save_matrix_with_zeros(matrix, "../data/combinated_deprojected_points.txt", layout.n_rows, layout.n_cols, camera_positions[0]);
+        }
+        if (exports.enabled(EXPORT_HEIGHTMAP_PNG)) {
+            normalizeAndInvert(matrix, output);
+            imwrite("../data/combinated_deprojected_image.png", output);
+        }
     }
 
-    save_matrix_with_zeros(big_matrix_combined, "../data/combinated_deprojected_points.txt", num_rows, num_cols, o_camera_position);
-    normalizeAndInvert(big_matrix_combined, output);
-    imwrite("../data/combinated_deprojected_image.png", output);
+    if (traversability.enabled) {
+        TraversabilityMap traversability_map;
+        compute_traversability(big_heightmap_combined, layout, traversability, traversability_map, capture_options.n_workers);
+        #if DEBUG
+        printf("Navigable cells: %llu, blocked cells: %llu\n", (unsigned long long)traversability_map.n_navigable,
+               (unsigned long long)traversability_map.n_blocked);
+        #endif
+        write_traversability("../data/traversability", traversability_map);
+    }
 
-    system("source ~/Desktop/robotics_project/.venv/bin/activate");
-    system("python ../hystogram.py");
+    // Statistics of the combined heightmap
+    MapStats map_stats;
+    compute_map_stats(big_heightmap_combined, layout, layers, fusion.enabled ? HEIGHTMAP_FUSED : HEIGHTMAP_MAX, map_stats);
+    write_map_stats("../data/map_stats.json", map_stats);
+    #if DEBUG
+    printf("Observed cells: %llu of %llu (%.1f%%), median height: %.0f mm\n", (unsigned long long)map_stats.n_written,
+           (unsigned long long)map_stats.n_cells, 100.0 * map_stats.fill_ratio, map_stats.median());
+    #endif
+    if (exports.enabled(EXPORT_HISTOGRAM_PNG)) {
+        Mat histogram;
+        render_histogram(map_stats, histogram);
+        imwrite("../data/histogram.png", histogram);
+    }
     return 0;
 }
@@ -0,0 +1,404 @@
+#include "resources.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Fills the pose record of an image.
+ *
+ * @param camera_position The camera position of the image.
+ * @param camera_angle The camera angle of the image.
+ * @param intrinsics The camera intrinsics of the image.
+ * @return SessionPose The record.
+ */
+SessionPose make_session_pose(const float camera_position[3], const float camera_angle[3], const rs2_intrinsics& intrinsics) {
+    SessionPose pose;
+    memset(&pose, 0, sizeof(pose));
+    for (int i = 0; i < 3; i++) {
+        pose.camera_position[i] = camera_position[i];
+        pose.camera_angle[i] = camera_angle[i];
+    }
+    pose.width = intrinsics.width;
+    pose.height = intrinsics.height;
+    pose.ppx = intrinsics.ppx;
+    pose.ppy = intrinsics.ppy;
+    pose.fx = intrinsics.fx;
+    pose.fy = intrinsics.fy;
+    pose.model = intrinsics.model;
+    for (int i = 0; i < 5; i++) {
+        pose.coeffs[i] = intrinsics.coeffs[i];
+    }
+    return pose;
+}
+
+/**
+ * @brief Hashes bytes with 64-bit FNV-1a.
+ *
+ * @param data The bytes.
+ * @param length The number of bytes.
+ * @param seed The hash of the previous bytes, to hash several buffers as one.
+ * @return uint64_t The hash.
+ */
+uint64_t session_hash(const void* data, size_t length, uint64_t seed) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Computes the key of the points of an image: a hash of the points and of what they were computed from.
+ *
+ * @param points The world frame points.
+ * @param camera_position The camera position of the image.
+ * @param camera_angle The camera angle of the image.
+ * @param min_dist The minimum distance of the points (mm).
+ * @param max_dist The maximum distance of the points (mm).
+ * @return uint64_t The key, never 0.
+ */
+uint64_t session_points_key(const PointCloud& points, const float camera_position[3], const float camera_angle[3], int min_dist, int max_dist) {
+    int32_t dists[2] = { min_dist, max_dist };
+    uint64_t hash = session_hash(camera_position, 3 * sizeof(float));
+    hash = session_hash(camera_angle, 3 * sizeof(float), hash);
+    hash = session_hash(dists, sizeof(dists), hash);
+    hash = session_hash(points.x.data(), points.size() * sizeof(float), hash);
+    hash = session_hash(points.y.data(), points.size() * sizeof(float), hash);
+    hash = session_hash(points.z.data(), points.size() * sizeof(float), hash);
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief Computes the key of the grid binned from the points of an image.
+ *
+ * @param points_key The key of the points, 0 if unknown.
+ * @param cell_dim The dimension of each cell (in milimiters).
+ * @param noise The noise model weighting the points, null if they are not weighted.
+ * @return uint64_t The key, 0 if the key of the points is unknown.
+ */
+uint64_t session_grid_key(uint64_t points_key, int cell_dim, const NoiseModel* noise) {
+    if (points_key == 0) {
+        return 0;
+    }
+    int32_t settings[2] = { cell_dim, MAX_ERROR };
+    double model[2] = { noise ? noise->sigma0 : 0.0, noise ? noise->quadratic : 0.0 };
+    uint64_t hash = session_hash(&points_key, sizeof(points_key));
+    hash = session_hash(settings, sizeof(settings), hash);
+    hash = session_hash(model, sizeof(model), hash);
+    return hash ? hash : 1;
+}
+
+// Checks the footer of a session file of the given length, and where its index is
+static bool valid_footer(const SessionFooter& footer, uint64_t length) {
+    return memcmp(footer.magic, SESSION_INDEX_MAGIC, 4) == 0 && footer.index_offset >= sizeof(SessionFileHeader) &&
+           footer.index_offset + (uint64_t)footer.n_records * sizeof(SessionRecord) + sizeof(SessionFooter) <= length;
+}
+
+/**
+ * @brief Creates an empty session file, replacing any previous one.
+ *
+ * @param filename The file to create.
+ * @param header The settings of the session, the magic and version are filled in.
+ * @return true if the file was created.
+ */
+bool SessionWriter::create(const char filename[], const SessionFileHeader& header) {
+    close();
+    lock_guard<std::mutex> lock(mutex);
+    file.open(filename, ios::in | ios::out | ios::binary | ios::trunc);
+    if (!file.is_open()) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    SessionFileHeader h = header;
+    memcpy(h.magic, SESSION_FILE_MAGIC, 4);
+    h.version = SESSION_FILE_VERSION;
+    file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    end = sizeof(h);
+    index.clear();
+    return file.good();
+}
+
+/**
+ * @brief Opens an existing session file to append records to it.
+ *
+ * @param filename The session file.
+ * @return true if the file was opened and its index read.
+ */
+bool SessionWriter::open(const char filename[]) {
+    close();
+    lock_guard<std::mutex> lock(mutex);
+    file.open(filename, ios::in | ios::out | ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    SessionFileHeader header;
+    SessionFooter footer;
+    file.seekg(0, ios::end);
+    uint64_t length = file.tellg();
+    file.seekg(0);
+    bool valid = length >= sizeof(header) + sizeof(footer) && file.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+                 memcmp(header.magic, SESSION_FILE_MAGIC, 4) == 0 && header.version == SESSION_FILE_VERSION;
+    if (valid) {
+        file.seekg(length - sizeof(footer));
+        valid = file.read(reinterpret_cast<char*>(&footer), sizeof(footer)) && valid_footer(footer, length);
+    }
+    if (valid) {
+        index.resize(footer.n_records);
+        file.seekg(footer.index_offset);
+        valid = (bool)file.read(reinterpret_cast<char*>(index.data()), index.size() * sizeof(SessionRecord));
+    }
+    if (!valid) {
+        cerr << "Invalid session file " << filename << endl;
+        file.close();
+        index.clear();
+        return false;
+    }
+    end = length;
+    return true;
+}
+
+bool SessionWriter::is_open() {
+    lock_guard<std::mutex> lock(mutex);
+    return file.is_open();
+}
+
+// Pads the file with zeros up to the next multiple of SESSION_ALIGN
+void SessionWriter::pad() {
+    static const char zeros[SESSION_ALIGN] = {};
+    size_t padding = (SESSION_ALIGN - end % SESSION_ALIGN) % SESSION_ALIGN;
+    file.write(zeros, padding);
+    end += padding;
+    return;
+}
+
+/**
+ * @brief Appends a record, replacing the record of the same kind of the image in the index.
+ *
+ * @param kind The kind of the record.
+ * @param image The image of the record.
+ * @param write Writes the content of the record to the stream, returns false on error.
+ * @param key The hash of the inputs of the record, 0 if none.
+ * @return true if the record was written.
+ */
+bool SessionWriter::append(SessionRecordKind kind, int image, const function<bool(ostream&)>& write, uint64_t key) {
+    lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.seekp(end);
+    pad();
+    SessionRecord record = { kind, image, end, 0, key };
+    if (!write(file) || !file.good()) {
+        cerr << "Error writing session record" << endl;
+        file.clear();
+        return false;
+    }
+    end = file.tellp();
+    record.length = end - record.offset;
+    auto same = find_if(index.begin(), index.end(), [&](const SessionRecord& r) { return r.kind == record.kind && r.image == record.image; });
+    if (same != index.end()) {
+        *same = record;
+    } else {
+        index.push_back(record);
+    }
+    return true;
+}
+
+bool SessionWriter::append(SessionRecordKind kind, int image, const void* data, size_t length, uint64_t key) {
+    return append(kind, image, [&](ostream& stream) {
+        stream.write(static_cast<const char*>(data), length);
+        return stream.good();
+    }, key);
+}
+
+/**
+ * @brief Appends a matrix record.
+ *
+ * @param kind The kind of the record.
+ * @param image The image of the record.
+ * @param matrix The matrix.
+ * @return true if the record was written.
+ */
+bool SessionWriter::append_matrix(SessionRecordKind kind, int image, const Mat& matrix) {
+    return append(kind, image, [&](ostream& stream) {
+        SessionMatrixHeader header = { matrix.rows, matrix.cols, matrix.type(), 0 };
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (int row = 0; row < matrix.rows; row++) {
+            stream.write(reinterpret_cast<const char*>(matrix.ptr(row)), matrix.cols * matrix.elemSize());
+        }
+        return stream.good();
+    });
+}
+
+/**
+ * @brief Returns the key of the indexed record of an image, 0 if it has none.
+ */
+uint64_t SessionWriter::key(SessionRecordKind kind, int image) {
+    lock_guard<std::mutex> lock(mutex);
+    for (const SessionRecord& record : index) {
+        if (record.kind == (uint32_t)kind && record.image == image) {
+            return record.key;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the index and the footer, making the records appended so far visible.
+ *
+ * @return true if the index was written.
+ */
+bool SessionWriter::commit() {
+    lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.seekp(end);
+    pad();
+    SessionFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    memcpy(footer.magic, SESSION_INDEX_MAGIC, 4);
+    footer.n_records = index.size();
+    footer.index_offset = end;
+    file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(SessionRecord));
+    file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    file.flush();
+    end = file.tellp();
+    return file.good();
+}
+
+void SessionWriter::close() {
+    lock_guard<std::mutex> lock(mutex);
+    if (file.is_open()) {
+        file.close();
+    }
+    index.clear();
+    end = 0;
+}
+
+/**
+ * @brief Maps a session file in memory and indexes its records.
+ *
+ * @param filename The session file.
+ * @return true if the file was mapped and is a valid session file.
+ */
+bool SessionFile::open(const char filename[]) {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SessionFileHeader) + sizeof(SessionFooter)) {
+        cerr << "Invalid session file " << filename << endl;
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        cerr << "Error mapping file " << filename << endl;
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+    length = st.st_size;
+
+    const SessionFooter& footer = *reinterpret_cast<const SessionFooter*>(data + length - sizeof(SessionFooter));
+    if (memcmp(header().magic, SESSION_FILE_MAGIC, 4) != 0 || header().version != SESSION_FILE_VERSION || !valid_footer(footer, length)) {
+        cerr << "Invalid session file " << filename << endl;
+        close();
+        return false;
+    }
+    const SessionRecord* index = reinterpret_cast<const SessionRecord*>(data + footer.index_offset);
+    for (uint32_t i = 0; i < footer.n_records; i++) {
+        const SessionRecord& record = index[i];
+        if (record.kind >= SESSION_RECORD_KINDS || record.image < 0 || record.offset + record.length > footer.index_offset) {
+            continue;
+        }
+        if ((size_t)record.image >= records.size()) {
+            records.resize(record.image + 1, vector<const SessionRecord*>(SESSION_RECORD_KINDS, nullptr));
+        }
+        records[record.image][record.kind] = &record;
+    }
+    return true;
+}
+
+void SessionFile::close() {
+    if (data) {
+        munmap(const_cast<uint8_t*>(data), length);
+        data = nullptr;
+        length = 0;
+    }
+    records.clear();
+}
+
+/**
+ * @brief Returns the content of a record, nullptr if the image has no record of this kind.
+ *
+ * @param kind The kind of the record.
+ * @param image The image of the record.
+ * @param record_length If not null, receives the length of the record in bytes.
+ */
+const void* SessionFile::record(SessionRecordKind kind, int image, size_t* record_length) const {
+    if (image < 0 || image >= n_images() || !records[image][kind]) {
+        return nullptr;
+    }
+    const SessionRecord* record = records[image][kind];
+    if (record_length) {
+        *record_length = record->length;
+    }
+    return data + record->offset;
+}
+
+uint64_t SessionFile::key(SessionRecordKind kind, int image) const {
+    return image >= 0 && image < n_images() && records[image][kind] ? records[image][kind]->key : 0;
+}
+
+const SessionPose* SessionFile::pose(int image) const {
+    size_t record_length;
+    const void* content = record(SESSION_POSE, image, &record_length);
+    return content && record_length >= sizeof(SessionPose) ? static_cast<const SessionPose*>(content) : nullptr;
+}
+
+/**
+ * @brief Returns a matrix record, in place: the matrix is only valid while the file is open.
+ *
+ * @param kind The kind of the record.
+ * @param image The image of the record.
+ * @param matrix Receives the matrix.
+ * @return true if the image has a valid record of this kind.
+ */
+bool SessionFile::matrix(SessionRecordKind kind, int image, Mat& matrix) const {
+    size_t record_length;
+    const uint8_t* content = static_cast<const uint8_t*>(record(kind, image, &record_length));
+    if (!content || record_length < sizeof(SessionMatrixHeader)) {
+        return false;
+    }
+    const SessionMatrixHeader& h = *reinterpret_cast<const SessionMatrixHeader*>(content);
+    if (h.rows <= 0 || h.cols <= 0 || record_length < sizeof(h) + (size_t)h.rows * h.cols * CV_ELEM_SIZE(h.type)) {
+        return false;
+    }
+    matrix = Mat(h.rows, h.cols, h.type, const_cast<uint8_t*>(content + sizeof(h)));
+    return true;
+}
+
+/**
+ * @brief Views the points of an image, only valid while the file is open.
+ */
+bool SessionFile::points(int image, MappedPointFile& file) const {
+    size_t record_length;
+    const void* content = record(SESSION_POINTS, image, &record_length);
+    return content && file.view(content, record_length);
+}
+
+/**
+ * @brief Views the heightmap of an image, only valid while the file is open.
+ */
+bool SessionFile::grid(int image, MappedHeightmapFile& file) const {
+    size_t record_length;
+    const void* content = record(SESSION_GRID, image, &record_length);
+    return content && file.view(content, record_length);
+}
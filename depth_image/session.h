@@ -0,0 +1,168 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <librealsense2/rs.hpp>
+#include <opencv2/opencv.hpp>
+#include "point_file.h"
+#include "heightmap_file.h"
+
+#define SESSION_FILE_MAGIC "DSES"
+#define SESSION_INDEX_MAGIC "DIDX"
+#define SESSION_FILE_VERSION 1
+// Alignment of the records and of the index in a session file
+#define SESSION_ALIGN 64
+// Seed of session_hash() (FNV-1a offset basis)
+#define SESSION_HASH_SEED 0xcbf29ce484222325ULL
+
+// Kinds of the records of a session file
+enum SessionRecordKind : uint32_t {
+    SESSION_POSE = 0,            // SessionPose
+    SESSION_MEAN_DEPTH = 1,      // SessionMatrixHeader followed by the mean depth image (mm, CV_32FC1)
+    SESSION_DEPTH_VARIANCE = 2,  // SessionMatrixHeader followed by the per-pixel variance (mm^2, CV_32FC1)
+    SESSION_POINTS = 3,          // A point file (see point_file.h), world frame
+    SESSION_GRID = 4,            // The heightmap binned from the points alone, see write_heightmap_state()
+    SESSION_RECORD_KINDS = 5
+};
+
+/**
+ * @brief Header of a session file.
+ *
+ * A session file holds every image of a session in a single append-only file: the header,
+ * then records aligned to SESSION_ALIGN bytes, then the index (an array of SessionRecord) and
+ * a SessionFooter at the very end. Updating an image appends its new records and a new index,
+ * the records it replaces stay in the file but are no longer indexed. All values are
+ * little-endian, and every record can be used in place when the file is memory mapped.
+ */
+struct SessionFileHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t min_dist;
+    int32_t max_dist;
+    int32_t n_frames;
+    int32_t cell_dim;
+    uint8_t reserved[40];
+};
+static_assert(sizeof(SessionFileHeader) == SESSION_ALIGN, "SessionFileHeader must be SESSION_ALIGN bytes");
+
+// Entry of the index of a session file
+struct SessionRecord {
+    uint32_t kind;
+    int32_t image;
+    uint64_t offset;  // From the start of the file
+    uint64_t length;  // In bytes, without the alignment padding
+    uint64_t key;     // Hash of the inputs the record was computed from, 0 if none
+};
+static_assert(sizeof(SessionRecord) == 32, "SessionRecord must be 32 bytes");
+
+// Last bytes of a session file, locating the current index
+struct SessionFooter {
+    char magic[4];
+    uint32_t n_records;
+    uint64_t index_offset;
+    uint8_t reserved[16];
+};
+static_assert(sizeof(SessionFooter) == 32, "SessionFooter must be 32 bytes");
+
+// Pose and intrinsics of an image
+struct SessionPose {
+    float camera_position[3];
+    float camera_angle[3];
+    int32_t width;
+    int32_t height;
+    float ppx;
+    float ppy;
+    float fx;
+    float fy;
+    int32_t model;
+    float coeffs[5];
+    uint8_t reserved[8];
+};
+static_assert(sizeof(SessionPose) == 80, "SessionPose must be 80 bytes");
+
+// Header of a matrix record
+struct SessionMatrixHeader {
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    int32_t reserved;
+};
+
+struct NoiseModel;
+
+SessionPose make_session_pose(const float camera_position[3], const float camera_angle[3], const rs2_intrinsics& intrinsics);
+uint64_t session_hash(const void* data, size_t length, uint64_t seed = SESSION_HASH_SEED);
+uint64_t session_points_key(const PointCloud& points, const float camera_position[3], const float camera_angle[3], int min_dist, int max_dist);
+uint64_t session_grid_key(uint64_t points_key, int cell_dim, const NoiseModel* noise);
+
+/**
+ * @brief Appends records to a session file.
+ *
+ * The records are only visible to readers once commit() has written the index. The methods
+ * can be called from several threads, such as the jobs of the output writer.
+ */
+class SessionWriter {
+public:
+    SessionWriter() : end(0) {}
+    ~SessionWriter() { close(); }
+    SessionWriter(const SessionWriter&) = delete;
+    SessionWriter& operator=(const SessionWriter&) = delete;
+
+    bool create(const char filename[], const SessionFileHeader& header);
+    bool open(const char filename[]);
+    bool is_open();
+    bool append(SessionRecordKind kind, int image, const std::function<bool(std::ostream&)>& write, uint64_t key = 0);
+    bool append(SessionRecordKind kind, int image, const void* data, size_t length, uint64_t key = 0);
+    bool append_matrix(SessionRecordKind kind, int image, const cv::Mat& matrix);
+    uint64_t key(SessionRecordKind kind, int image);
+    bool commit();
+    void close();
+
+private:
+    void pad();
+
+    std::mutex mutex;
+    std::fstream file;
+    std::vector<SessionRecord> index;
+    uint64_t end;
+};
+
+/**
+ * @brief Read-only memory mapping of a session file.
+ *
+ * Every record is found in constant time from its kind and image.
+ */
+class SessionFile {
+public:
+    SessionFile() : data(nullptr), length(0) {}
+    ~SessionFile() { close(); }
+    SessionFile(const SessionFile&) = delete;
+    SessionFile& operator=(const SessionFile&) = delete;
+
+    bool open(const char filename[]);
+    void close();
+    bool is_open() const { return data != nullptr; }
+
+    const SessionFileHeader& header() const { return *reinterpret_cast<const SessionFileHeader*>(data); }
+    int n_images() const { return records.size(); }
+    const void* record(SessionRecordKind kind, int image, size_t* record_length = nullptr) const;
+    uint64_t key(SessionRecordKind kind, int image) const;
+    const SessionPose* pose(int image) const;
+    bool matrix(SessionRecordKind kind, int image, cv::Mat& matrix) const;
+    bool points(int image, MappedPointFile& file) const;
+    bool grid(int image, MappedHeightmapFile& file) const;
+
+private:
+    const uint8_t* data;
+    size_t length;
+    // Index entry of each kind of record of each image, nullptr if missing
+    std::vector<std::vector<const SessionRecord*>> records;
+};
+
+#endif // SESSION_H
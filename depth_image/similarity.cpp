@@ -0,0 +1,100 @@
+#include "resources.h"
+
+/**
+ * @brief Adds pairs of cells, the pairs with an empty cell (0) are skipped.
+ *
+ * The sums are computed in a branchless loop the compiler can vectorize, the histogram is
+ * filled afterwards for each block.
+ *
+ * @param a The cells of the first grid.
+ * @param b The cells of the second grid.
+ * @param n_cells The number of cells.
+ */
+void SimilarityAccumulator::add(const int* a, const int* b, size_t n_cells) {
+    uint32_t bins[SIMILARITY_BLOCK];
+    for (size_t start = 0; start < n_cells; start += SIMILARITY_BLOCK) {
+        size_t length = min<size_t>(SIMILARITY_BLOCK, n_cells - start);
+        const int* a_block = a + start;
+        const int* b_block = b + start;
+        uint64_t block_n = 0, block_abs = 0, block_max = 0;
+        double block_sq = 0.0;
+        for (size_t i = 0; i < length; ++i) {
+            int64_t value_a = a_block[i];
+            int64_t value_b = b_block[i];
+            uint64_t both = (value_a != 0) & (value_b != 0);
+            int64_t diff = (value_a - value_b) * (int64_t)both;
+            uint64_t abs_diff = (uint64_t)(diff < 0 ? -diff : diff);
+            block_n += both;
+            block_abs += abs_diff;
+            block_sq += (double)diff * (double)diff;
+            block_max = max(block_max, abs_diff);
+            uint64_t bin = min<uint64_t>(abs_diff, SIMILARITY_BINS - 1);
+            bins[i] = (uint32_t)(both ? bin : SIMILARITY_BINS);
+        }
+        for (size_t i = 0; i < length; ++i) {
+            histogram[bins[i]]++;
+        }
+        n += block_n;
+        sum_abs += block_abs;
+        sum_sq += block_sq;
+        max_abs = max(max_abs, block_max);
+    }
+    return;
+}
+
+/**
+ * @brief Computes the statistics of the pairs added so far.
+ *
+ * @param percentile The fraction of the overlapping cells for the percentile error (0 - 1).
+ * @return SimilarityStats The statistics, all zero without overlap.
+ */
+SimilarityStats SimilarityAccumulator::finish(double percentile) const {
+    SimilarityStats stats;
+    stats.n = n;
+    if (n == 0) {
+        return stats;
+    }
+    stats.rmse = sqrt(sum_sq / n);
+    stats.mad = (double)sum_abs / n;
+    stats.max_error = (double)max_abs;
+    uint64_t target = (uint64_t)ceil(min(max(percentile, 0.0), 1.0) * n);
+    uint64_t cumulative = 0;
+    for (int bin = 0; bin < SIMILARITY_BINS; ++bin) {
+        cumulative += histogram[bin];
+        if (cumulative >= target) {
+            stats.percentile_error = bin == SIMILARITY_BINS - 1 ? stats.max_error : bin;
+            break;
+        }
+    }
+    return stats;
+}
+
+/**
+ * @brief Decides whether two grids agree enough to be merged.
+ *
+ * @param stats The statistics of their overlap.
+ * @param thresholds The limits, the ones set to 0 are not checked.
+ * @return true if every enabled limit is met.
+ */
+bool similarity_accepts(const SimilarityStats& stats, const SimilarityThresholds& thresholds) {
+    #if DEBUG >= DEBUG_VERBOSE
+    printf("Overlap: %llu cells, RMSE: %.1f mm, MAD: %.1f mm, P%.0f: %.1f mm, max: %.1f mm\n",
+           (unsigned long long)stats.n, stats.rmse, stats.mad, 100.0 * thresholds.percentile, stats.percentile_error, stats.max_error);
+    #endif
+    if (stats.n == 0 || stats.n < thresholds.min_overlap) {
+        #if DEBUG
+        printf("Not enough overlap (at least %llu cells needed).\n", (unsigned long long)thresholds.min_overlap);
+        #endif
+        return false;
+    }
+    if (thresholds.max_rmse > 0 && stats.rmse > thresholds.max_rmse) {
+        return false;
+    }
+    if (thresholds.max_mad > 0 && stats.mad > thresholds.max_mad) {
+        return false;
+    }
+    if (thresholds.max_percentile_error > 0 && stats.percentile_error > thresholds.max_percentile_error) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef SIMILARITY_H
+#define SIMILARITY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 1 mm bins of the absolute difference, the last bin holds all the larger differences
+#define SIMILARITY_BINS 1024
+// Cells processed by each vectorized block
+#define SIMILARITY_BLOCK 1024
+
+// Agreement of two grids over the cells written in both (0 is an empty cell)
+struct SimilarityStats {
+    uint64_t n = 0;                 // Overlapping cells
+    double rmse = 0.0;              // Root mean squared difference (mm)
+    double mad = 0.0;               // Mean absolute difference (mm)
+    double percentile_error = 0.0;  // Absolute difference below which `percentile` of the cells are (mm)
+    double max_error = 0.0;         // Largest absolute difference (mm)
+};
+
+// When two grids agree enough to be merged, a threshold of 0 is not checked
+struct SimilarityThresholds {
+    double max_rmse = 20.0;             // mm
+    double max_mad = 0.0;               // mm
+    double percentile = 0.95;           // Fraction of the overlapping cells for percentile_error
+    double max_percentile_error = 0.0;  // mm
+    uint64_t min_overlap = 1;           // Fewest overlapping cells to accept a merge
+};
+
+/**
+ * @brief Accumulates the differences of pairs of grid cells.
+ *
+ * Sums are kept in 64-bit integers and doubles, so large overlaps of millimeter heights do not
+ * overflow. The differences are also counted in a histogram of SIMILARITY_BINS 1 mm bins for
+ * the percentile error.
+ */
+class SimilarityAccumulator {
+public:
+    SimilarityAccumulator() : n(0), sum_abs(0), sum_sq(0.0), max_abs(0), histogram(SIMILARITY_BINS + 1, 0) {}
+
+    void add(const int* a, const int* b, size_t n_cells);
+    SimilarityStats finish(double percentile) const;
+
+private:
+    uint64_t n;
+    uint64_t sum_abs;
+    double sum_sq;
+    uint64_t max_abs;
+    // The extra last bin receives the cells that are not written in both grids
+    std::vector<uint64_t> histogram;
+};
+
+bool similarity_accepts(const SimilarityStats& stats, const SimilarityThresholds& thresholds);
+
+#endif // SIMILARITY_H
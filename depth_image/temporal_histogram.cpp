@@ -0,0 +1,163 @@
+#include "resources.h"
+
+/**
+ * @brief Parses the name of a temporal estimator given on the command line.
+ *
+ * @param name One of "mean", "median", "trimmed" or "mode".
+ * @param estimator Receives the estimator.
+ * @return false if the name is not known.
+ */
+bool parse_temporal_estimator(const char name[], TemporalEstimator& estimator) {
+    if (strcmp(name, "mean") == 0) {
+        estimator = ESTIMATOR_MEAN;
+    } else if (strcmp(name, "median") == 0) {
+        estimator = ESTIMATOR_MEDIAN;
+    } else if (strcmp(name, "trimmed") == 0) {
+        estimator = ESTIMATOR_TRIMMED_MEAN;
+    } else if (strcmp(name, "mode") == 0) {
+        estimator = ESTIMATOR_MODE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Creates empty histograms for width x height pixels.
+ *
+ * @param width The width of the frames.
+ * @param height The height of the frames.
+ * @param bin_permille The width of a bin, in thousandths of the reference depth of the pixel.
+ */
+TemporalHistogram::TemporalHistogram(int width, int height, int bin_permille)
+    : width(width), height(height), bin_permille(bin_permille),
+      bins((size_t)width * height * TEMPORAL_BINS, 0), reference((size_t)width * height, 0),
+      inside((size_t)width * height, 0), outside((size_t)width * height, 0) {}
+
+void TemporalHistogram::reset() {
+    fill(bins.begin(), bins.end(), 0);
+    fill(reference.begin(), reference.end(), 0);
+    fill(inside.begin(), inside.end(), 0);
+    fill(outside.begin(), outside.end(), 0);
+}
+
+/**
+ * @brief Adds one row of depth samples.
+ *
+ * Rows may be added concurrently as long as they are different rows.
+ *
+ * @param y The row.
+ * @param depth_mm The clamped depth of each pixel of the row (in milimiters), 0 when invalid.
+ */
+void TemporalHistogram::add_row(int y, const uint16_t depth_mm[]) {
+    for (int x = 0; x < width; ++x) {
+        int depth = depth_mm[x];
+        size_t i = (size_t)y * width + x;
+        if (depth == 0 || inside[i] == UINT16_MAX) {
+            continue;
+        }
+        uint16_t* pixel_bins = &bins[i * TEMPORAL_BINS];
+        if (reference[i] == 0) {
+            reference[i] = (uint16_t)depth;
+        }
+        int w = bin_width(reference[i]);
+        int offset = depth - reference[i] + (TEMPORAL_BINS / 2) * w;
+        if (offset >= 0 && offset < TEMPORAL_BINS * w) {
+            pixel_bins[offset / w]++;
+            inside[i]++;
+        } else if (++outside[i] > inside[i]) {
+            // The window was centered on an outlier, start again from this sample
+            fill(pixel_bins, pixel_bins + TEMPORAL_BINS, 0);
+            reference[i] = (uint16_t)depth;
+            pixel_bins[TEMPORAL_BINS / 2]++;
+            inside[i] = 1;
+            outside[i] = 0;
+        }
+    }
+    return;
+}
+
+/**
+ * @brief Estimates the depth of one pixel from its histogram.
+ *
+ * Values inside a bin are assumed to be uniformly distributed. Outliers are not used.
+ *
+ * @param index The index of the pixel (y * width + x).
+ * @param estimator The estimator to use.
+ * @param trim_fraction The fraction of the samples discarded at each end by the trimmed mean.
+ * @return float The estimated depth (in milimiters), 0 if the pixel has no samples.
+ */
+float TemporalHistogram::estimate(int index, TemporalEstimator estimator, double trim_fraction) const {
+    const uint16_t* pixel_bins = &bins[(size_t)index * TEMPORAL_BINS];
+    const double n = inside[index];
+    if (n == 0) {
+        return 0.0f;
+    }
+    const int w = bin_width(reference[index]);
+    const double lower = reference[index] - (TEMPORAL_BINS / 2) * w;
+
+    if (estimator == ESTIMATOR_MODE) {
+        int peak = (int)(max_element(pixel_bins, pixel_bins + TEMPORAL_BINS) - pixel_bins);
+        double weight = 0.0, weighted_sum = 0.0;
+        for (int b = max(peak - 1, 0); b <= min(peak + 1, TEMPORAL_BINS - 1); b++) {
+            weight += pixel_bins[b];
+            weighted_sum += pixel_bins[b] * (lower + (b + 0.5) * w);
+        }
+        return (float)(weighted_sum / weight);
+    }
+
+    if (estimator == ESTIMATOR_TRIMMED_MEAN) {
+        double skip_low = floor(trim_fraction * n);
+        double skip_high = skip_low;
+        double weight = 0.0, weighted_sum = 0.0;
+        double cumulative = 0.0;
+        for (int b = 0; b < TEMPORAL_BINS; b++) {
+            // Part of the bin between the skip_low-th and the (n - skip_high)-th sample
+            double start = max(cumulative, skip_low);
+            double end = min(cumulative + pixel_bins[b], n - skip_high);
+            if (end > start) {
+                weight += end - start;
+                weighted_sum += (end - start) * (lower + (b + 0.5) * w);
+            }
+            cumulative += pixel_bins[b];
+        }
+        if (weight > 0.0) {
+            return (float)(weighted_sum / weight);
+        }
+    }
+
+    // Median, interpolated inside its bin
+    double half = n / 2.0;
+    double cumulative = 0.0;
+    for (int b = 0; b < TEMPORAL_BINS; b++) {
+        if (pixel_bins[b] > 0 && cumulative + pixel_bins[b] >= half) {
+            return (float)(lower + (b + (half - cumulative) / pixel_bins[b]) * w);
+        }
+        cumulative += pixel_bins[b];
+    }
+    return (float)(lower + TEMPORAL_BINS * w);
+}
+
+/**
+ * @brief Computes the depth image with a robust estimator.
+ *
+ * Estimates at or above 99% of max_dist are set to max_dist, as the mean does.
+ *
+ * @param depth The estimated depth of each pixel (CV_32FC1, in milimiters), 0 without samples.
+ * @param estimator The estimator to use.
+ * @param max_dist The maximum distance of the depth measurements (in milimiters).
+ * @param trim_fraction The fraction of the samples discarded at each end by the trimmed mean.
+ */
+void TemporalHistogram::finalize(Mat& depth, TemporalEstimator estimator, int max_dist, double trim_fraction) const {
+    depth = Mat::zeros(height, width, CV_32FC1);
+    parallel_for_(Range(0, height), [&](const Range& rows) {
+        for (int y = rows.start; y < rows.end; ++y) {
+            float* depth_row = depth.ptr<float>(y);
+            for (int x = 0; x < width; ++x) {
+                float value = estimate(y * width + x, estimator, trim_fraction);
+                depth_row[x] = value >= 0.99f * max_dist ? (float)max_dist : value;
+            }
+        }
+    });
+    return;
+}
@@ -0,0 +1,51 @@
+#ifndef TEMPORAL_HISTOGRAM_H
+#define TEMPORAL_HISTOGRAM_H
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Number of bins kept for each pixel
+#define TEMPORAL_BINS 32
+
+// How the depth of a pixel is estimated from its samples over time
+enum TemporalEstimator {
+    ESTIMATOR_MEAN,
+    ESTIMATOR_MEDIAN,
+    ESTIMATOR_TRIMMED_MEAN,
+    ESTIMATOR_MODE
+};
+
+bool parse_temporal_estimator(const char name[], TemporalEstimator& estimator);
+
+/**
+ * @brief Bounded per-pixel depth histograms for robust temporal estimators.
+ *
+ * Each pixel keeps TEMPORAL_BINS bins centered on a reference depth, each bin
+ * bin_permille/1000 of the reference wide, so memory does not grow with the number of frames.
+ * Samples outside the window are counted as outliers (flying pixels). If the outliers ever
+ * outnumber the samples inside the window, the reference was an outlier itself and the
+ * window is recentered on the latest sample.
+ */
+class TemporalHistogram {
+public:
+    TemporalHistogram(int width, int height, int bin_permille = 5);
+
+    void reset();
+    void add_row(int y, const uint16_t depth_mm[]);
+    float estimate(int index, TemporalEstimator estimator, double trim_fraction) const;
+    void finalize(cv::Mat& depth, TemporalEstimator estimator, int max_dist, double trim_fraction = 0.2) const;
+
+private:
+    int bin_width(int reference) const { return std::max(1, reference * bin_permille / 1000); }
+
+    int width;
+    int height;
+    int bin_permille;
+    std::vector<uint16_t> bins;       // TEMPORAL_BINS per pixel
+    std::vector<uint16_t> reference;  // Center of the window of each pixel (mm), 0 before the first sample
+    std::vector<uint16_t> inside;     // Samples inside the window
+    std::vector<uint16_t> outside;    // Samples outside the window
+};
+
+#endif // TEMPORAL_HISTOGRAM_H
@@ -0,0 +1,143 @@
+#include "text_reader.h"
+#include <charconv>
+#include <cstring>
+#include <iostream>
+
+/**
+ * @brief Opens a text file for reading.
+ *
+ * @param filename The file to read.
+ * @return true if the file was opened.
+ */
+bool TextReader::open(const char filename[]) {
+    close();
+    file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+    buffer.resize(TEXT_READER_CHUNK);
+    begin = end = 0;
+    eof = false;
+    n_lines = 0;
+    return true;
+}
+
+void TextReader::close() {
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+/**
+ * @brief Moves the unread bytes to the front of the buffer and reads the next chunk after them.
+ *
+ * @return true if new bytes were read.
+ */
+bool TextReader::fill() {
+    if (eof) {
+        return false;
+    }
+    if (begin > 0) {
+        memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+    }
+    if (end == buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+    }
+    size_t n_read = fread(buffer.data() + end, 1, buffer.size() - end, file);
+    if (n_read == 0) {
+        eof = true;
+        return false;
+    }
+    end += n_read;
+    return true;
+}
+
+/**
+ * @brief Returns the next line of the file.
+ *
+ * The range is valid until the next call. The last line does not need a trailing newline.
+ *
+ * @param line_begin Receives the first character of the line.
+ * @param line_end Receives one past the last character of the line, without the newline.
+ * @return true if a line was read, false at the end of the file.
+ */
+bool TextReader::next_line(const char*& line_begin, const char*& line_end) {
+    if (!file) {
+        return false;
+    }
+    size_t scanned = begin;
+    while (true) {
+        const char* newline = static_cast<const char*>(memchr(buffer.data() + scanned, '\n', end - scanned));
+        if (newline) {
+            line_begin = buffer.data() + begin;
+            line_end = newline;
+            begin = newline - buffer.data() + 1;
+            break;
+        }
+        scanned = end - begin;
+        if (!fill()) {
+            if (begin == end) {
+                return false;
+            }
+            line_begin = buffer.data() + begin;
+            line_end = buffer.data() + end;
+            begin = end;
+            break;
+        }
+    }
+    if (line_end > line_begin && line_end[-1] == '\r') {
+        line_end--;
+    }
+    n_lines++;
+    return true;
+}
+
+/**
+ * @brief Parses separated numbers from a line with std::from_chars.
+ *
+ * Blanks around the numbers and the separators are skipped, like the stream operators do.
+ * Anything after the last requested value is ignored.
+ *
+ * @param begin The first character of the line.
+ * @param end One past the last character of the line.
+ * @param values Receives the values.
+ * @param n_values The number of values to parse.
+ * @param separator The character between two values.
+ * @return int The number of values parsed before the first error.
+ */
+int parse_values(const char* begin, const char* end, double values[], int n_values, char separator) {
+    const char* p = begin;
+    for (int i = 0; i < n_values; i++) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (i > 0) {
+            if (p == end || *p != separator) {
+                return i;
+            }
+            p++;
+            while (p < end && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+        }
+        // from_chars does not accept a leading '+'
+        if (p < end && *p == '+') {
+            p++;
+        }
+        std::from_chars_result result = std::from_chars(p, end, values[i]);
+        if (result.ec != std::errc()) {
+            return i;
+        }
+        p = result.ptr;
+    }
+    return n_values;
+}
+
+void print_invalid_line(const char* begin, const char* end) {
+    std::cerr << "Invalid line format: ";
+    std::cerr.write(begin, end - begin);
+    std::cerr << std::endl;
+}
@@ -0,0 +1,45 @@
+#ifndef TEXT_READER_H
+#define TEXT_READER_H
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+#define TEXT_READER_CHUNK (1 << 20)
+
+/**
+ * @brief Line reader for the text point and grid files.
+ *
+ * The file is read in large chunks and the lines are returned as [begin, end) ranges inside
+ * the chunk, without copying them or allocating per line. Lines longer than a chunk grow
+ * the buffer. '\r' line endings are stripped.
+ */
+class TextReader {
+public:
+    TextReader() : file(nullptr), begin(0), end(0), eof(false), n_lines(0) {}
+    ~TextReader() { close(); }
+    TextReader(const TextReader&) = delete;
+    TextReader& operator=(const TextReader&) = delete;
+
+    bool open(const char filename[]);
+    void close();
+    bool is_open() const { return file != nullptr; }
+    bool next_line(const char*& line_begin, const char*& line_end);
+    // Number of the last line returned, starting from 1
+    size_t line_number() const { return n_lines; }
+
+private:
+    bool fill();
+
+    FILE* file;
+    std::vector<char> buffer;
+    size_t begin;
+    size_t end;
+    bool eof;
+    size_t n_lines;
+};
+
+int parse_values(const char* begin, const char* end, double values[], int n_values, char separator = ',');
+void print_invalid_line(const char* begin, const char* end);
+
+#endif // TEXT_READER_H
@@ -0,0 +1,233 @@
+#include "resources.h"
+#include <atomic>
+#include <cfloat>
+
+/**
+ * @brief Computes the traversability layers of one block of the map.
+ *
+ * The stencils are separable: a horizontal pass over the rows of the block and its halo, then
+ * a vertical pass over the rows of the block. Every cell carries a weight (1 if written, 0 if
+ * empty) through both passes, so an empty cell never contributes to its neighbours, and the
+ * inner loops are branchless so the compiler can vectorize them.
+ *
+ * @param heights The heights with a border of pad empty cells, 0 on the empty cells (CV_32FC1).
+ * @param weights The weights with the same border (CV_32FC1).
+ * @param pad The width of the border, at least 1 and options.radius.
+ * @param cell_dim The dimension of each cell (in milimiters).
+ * @param options The window and the limits of a navigable cell.
+ * @param block The cells to compute, in the coordinates of the map without border.
+ * @param map Receives the layers of the block.
+ * @param n_navigable Incremented by the navigable cells of the block.
+ * @param n_blocked Incremented by the non navigable cells of the block.
+ */
+static void traversability_block(const Mat& heights, const Mat& weights, int pad, int cell_dim, const TraversabilityOptions& options,
+                                 const Rect& block, TraversabilityMap& map, uint64_t& n_navigable, uint64_t& n_blocked) {
+    int radius = options.radius;
+    int width = block.width;
+    int n_rows = block.height + 2 * pad;
+    size_t size = (size_t)n_rows * width;
+
+    // Horizontal pass: x differences, [1 2 1] smoothing along x, and window sums, maxima and minima
+    vector<float> dx(size), dx_weight(size), smooth(size), smooth_weight(size), count(size, 0.0f);
+    vector<float> high(size, -FLT_MAX), low(size, FLT_MAX);
+    vector<double> sum(size, 0.0), sum_sq(size, 0.0);
+    for (int i = 0; i < n_rows; ++i) {
+        // Row i of the block and its halo is row block.y + i of the bordered matrices
+        const float* h = heights.ptr<float>(block.y + i) + block.x + pad;
+        const float* w = weights.ptr<float>(block.y + i) + block.x + pad;
+        size_t row = (size_t)i * width;
+        for (int j = 0; j < width; ++j) {
+            // Central difference, or one-sided when a neighbour is empty
+            float both = w[j - 1] * w[j + 1];
+            float right = w[j] * w[j + 1] * (1.0f - both);
+            float left = w[j] * w[j - 1] * (1.0f - both) * (1.0f - right);
+            dx[row + j] = both * 0.5f * (h[j + 1] - h[j - 1]) + right * (h[j + 1] - h[j]) + left * (h[j] - h[j - 1]);
+            dx_weight[row + j] = both + right + left;
+            // The neighbours are smoothed in pairs, so an empty one does not move the center
+            smooth[row + j] = 2.0f * h[j] + both * (h[j - 1] + h[j + 1]);
+            smooth_weight[row + j] = 2.0f * (w[j] + both);
+        }
+        for (int k = -radius; k <= radius; ++k) {
+            for (int j = 0; j < width; ++j) {
+                float value = h[j + k];
+                count[row + j] += w[j + k];
+                sum[row + j] += value;
+                sum_sq[row + j] += (double)value * value;
+                high[row + j] = max(high[row + j], w[j + k] > 0.0f ? value : -FLT_MAX);
+                low[row + j] = min(low[row + j], w[j + k] > 0.0f ? value : FLT_MAX);
+            }
+        }
+    }
+
+    // Vertical pass over the rows of the block
+    vector<float> window_count(width), window_high(width), window_low(width);
+    vector<double> window_sum(width), window_sum_sq(width);
+    float max_slope = options.max_slope > 0 ? options.max_slope : FLT_MAX;
+    float max_step = options.max_step > 0 ? options.max_step : FLT_MAX;
+    float max_roughness = options.max_roughness > 0 ? options.max_roughness : FLT_MAX;
+    uint64_t navigable = 0, blocked = 0;
+    for (int i = pad; i < pad + block.height; ++i) {
+        const float* h = heights.ptr<float>(block.y + i) + block.x + pad;
+        const float* w = weights.ptr<float>(block.y + i) + block.x + pad;
+        size_t row = (size_t)i * width, up = row - width, down = row + width;
+        fill(window_count.begin(), window_count.end(), 0.0f);
+        fill(window_sum.begin(), window_sum.end(), 0.0);
+        fill(window_sum_sq.begin(), window_sum_sq.end(), 0.0);
+        fill(window_high.begin(), window_high.end(), -FLT_MAX);
+        fill(window_low.begin(), window_low.end(), FLT_MAX);
+        for (int k = -radius; k <= radius; ++k) {
+            size_t other = row + (ptrdiff_t)k * width;
+            for (int j = 0; j < width; ++j) {
+                window_count[j] += count[other + j];
+                window_sum[j] += sum[other + j];
+                window_sum_sq[j] += sum_sq[other + j];
+                window_high[j] = max(window_high[j], high[other + j]);
+                window_low[j] = min(window_low[j], low[other + j]);
+            }
+        }
+
+        int out_row = block.y + i - pad;
+        float* slope = map.slope.ptr<float>(out_row) + block.x;
+        float* roughness = map.roughness.ptr<float>(out_row) + block.x;
+        float* step = map.step.ptr<float>(out_row) + block.x;
+        uchar* result = map.navigable.ptr<uchar>(out_row) + block.x;
+        for (int j = 0; j < width; ++j) {
+            // [1 2 1] smoothing of the x differences along y
+            float gx_weight = dx_weight[up + j] + 2.0f * dx_weight[row + j] + dx_weight[down + j];
+            float gx = (dx[up + j] + 2.0f * dx[row + j] + dx[down + j]) / max(gx_weight, 1.0f);
+            // y differences of the smoothed heights, the row above is y + 1
+            float up_ok = smooth_weight[up + j] > 0.0f, center_ok = smooth_weight[row + j] > 0.0f, down_ok = smooth_weight[down + j] > 0.0f;
+            float h_up = smooth[up + j] / max(smooth_weight[up + j], 1.0f);
+            float h_center = smooth[row + j] / max(smooth_weight[row + j], 1.0f);
+            float h_down = smooth[down + j] / max(smooth_weight[down + j], 1.0f);
+            float both = up_ok * down_ok;
+            float upper = up_ok * center_ok * (1.0f - both);
+            float lower = center_ok * down_ok * (1.0f - both) * (1.0f - upper);
+            float gy = both * 0.5f * (h_up - h_down) + upper * (h_up - h_center) + lower * (h_center - h_down);
+
+            float n = max(window_count[j], 1.0f);
+            double mean = window_sum[j] / n;
+            double variance = max(0.0, window_sum_sq[j] / n - mean * mean);
+
+            float written = w[j];
+            slope[j] = written * (float)(atan(sqrt(gx * gx + gy * gy) / cell_dim) * 180.0 / M_PI);
+            roughness[j] = written * (float)sqrt(variance);
+            step[j] = written * max(window_high[j] - h[j], h[j] - window_low[j]);
+            bool ok = slope[j] <= max_slope && step[j] <= max_step && roughness[j] <= max_roughness;
+            result[j] = written == 0.0f ? TRAVERSABLE_UNKNOWN : (ok ? TRAVERSABLE_YES : TRAVERSABLE_NO);
+            navigable += written != 0.0f && ok;
+            blocked += written != 0.0f && !ok;
+        }
+    }
+    n_navigable += navigable;
+    n_blocked += blocked;
+    return;
+}
+
+/**
+ * @brief Computes the slope, roughness and step layers of a dense heightmap, and which cells are navigable.
+ *
+ * The map is split in blocks of TRAVERSABILITY_BLOCK x TRAVERSABILITY_BLOCK cells computed in
+ * parallel. The slope comes from a Sobel-like 3x3 gradient, the roughness and the step from
+ * the written cells of the (2 * radius + 1) square window. Empty cells are skipped by the
+ * stencils and marked TRAVERSABLE_UNKNOWN.
+ *
+ * @param heights The heights (mm, any single channel type).
+ * @param valid Non zero on the written cells (CV_8UC1, same size).
+ * @param cell_dim The dimension of each cell (in milimiters).
+ * @param options The window and the limits of a navigable cell.
+ * @param map Receives the layers, same size as heights.
+ * @param n_workers The number of threads to use, 0 uses the OpenCV thread count.
+ */
+void compute_traversability(const Mat& heights, const Mat& valid, int cell_dim, const TraversabilityOptions& options,
+                            TraversabilityMap& map, int n_workers) {
+    #if DEBUG
+    auto start = chrono::steady_clock::now();
+    #endif
+    ScopedNumThreads threads(n_workers);
+    TraversabilityOptions settings = options;
+    settings.radius = max(1, settings.radius);
+    int pad = settings.radius;
+
+    // Weights (1 written, 0 empty) and heights, with a border of empty cells
+    Mat weights, masked, bordered_heights, bordered_weights;
+    Mat written = valid != 0;
+    written.convertTo(weights, CV_32F, 1.0 / 255.0);
+    heights.convertTo(masked, CV_32F);
+    masked = masked.mul(weights);
+    copyMakeBorder(masked, bordered_heights, pad, pad, pad, pad, BORDER_CONSTANT, Scalar::all(0));
+    copyMakeBorder(weights, bordered_weights, pad, pad, pad, pad, BORDER_CONSTANT, Scalar::all(0));
+
+    map.slope.create(heights.size(), CV_32FC1);
+    map.roughness.create(heights.size(), CV_32FC1);
+    map.step.create(heights.size(), CV_32FC1);
+    map.navigable.create(heights.size(), CV_8UC1);
+
+    int blocks_x = (heights.cols + TRAVERSABILITY_BLOCK - 1) / TRAVERSABILITY_BLOCK;
+    int blocks_y = (heights.rows + TRAVERSABILITY_BLOCK - 1) / TRAVERSABILITY_BLOCK;
+    atomic<uint64_t> n_navigable(0), n_blocked(0);
+    parallel_for_(Range(0, blocks_x * blocks_y), [&](const Range& range) {
+        uint64_t navigable = 0, blocked = 0;
+        for (int b = range.start; b < range.end; ++b) {
+            int x = (b % blocks_x) * TRAVERSABILITY_BLOCK;
+            int y = (b / blocks_x) * TRAVERSABILITY_BLOCK;
+            Rect block(x, y, min(TRAVERSABILITY_BLOCK, heights.cols - x), min(TRAVERSABILITY_BLOCK, heights.rows - y));
+            traversability_block(bordered_heights, bordered_weights, pad, cell_dim, settings, block, map, navigable, blocked);
+        }
+        n_navigable += navigable;
+        n_blocked += blocked;
+    });
+    map.n_navigable = n_navigable;
+    map.n_blocked = n_blocked;
+    #if DEBUG
+    printf("Traversability: %dx%d cells in %.1f ms\n", heights.cols, heights.rows,
+           chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    #endif
+    return;
+}
+
+/**
+ * @brief Computes the traversability layers of a tiled heightmap.
+ *
+ * The mean height of each cell is used, so a single outlier point does not raise a step.
+ *
+ * @param heightmap The heightmap.
+ * @param layout The part of the heightmap to compute.
+ * @param options The window and the limits of a navigable cell.
+ * @param map Receives the layers (layout.n_rows x layout.n_cols).
+ * @param n_workers The number of threads to use, 0 uses the OpenCV thread count.
+ */
+void compute_traversability(const TiledHeightmap& heightmap, const HeightmapLayout& layout, const TraversabilityOptions& options,
+                            TraversabilityMap& map, int n_workers) {
+    Mat heights, count;
+    heightmap.to_mat(layout, heights, HEIGHTMAP_MEAN);
+    heightmap.to_mat(layout, count, HEIGHTMAP_COUNT);
+    compute_traversability(heights, count > 0, heightmap.get_cell_dim(), options, map, n_workers);
+    return;
+}
+
+/**
+ * @brief Writes the traversability layers.
+ *
+ * The navigable layer goes to <prefix>.png, the slope, roughness and step layers to
+ * <prefix>_slope.tiff, <prefix>_roughness.tiff and <prefix>_step.tiff as 32-bit float TIFF
+ * images, in degrees and milimiters.
+ *
+ * @param prefix The path of the files without the suffix and the extension.
+ * @param map The traversability layers.
+ * @return true if every file was written.
+ */
+bool write_traversability(const string& prefix, const TraversabilityMap& map) {
+    const pair<const char*, const Mat*> outputs[] = {
+        { ".png", &map.navigable }, { "_slope.tiff", &map.slope }, { "_roughness.tiff", &map.roughness }, { "_step.tiff", &map.step }
+    };
+    bool written = true;
+    for (const auto& output : outputs) {
+        string filename = prefix + output.first;
+        if (!imwrite(filename, *output.second)) {
+            cerr << "Error writing file " << filename << endl;
+            written = false;
+        }
+    }
+    return written;
+}
@@ -0,0 +1,41 @@
+#ifndef TRAVERSABILITY_H
+#define TRAVERSABILITY_H
+
+#include <string>
+#include <opencv2/opencv.hpp>
+#include "heightmap.h"
+
+// Cells processed by each parallel block (TRAVERSABILITY_BLOCK x TRAVERSABILITY_BLOCK)
+#define TRAVERSABILITY_BLOCK 128
+
+// Values of the navigable layer
+#define TRAVERSABLE_NO 0
+#define TRAVERSABLE_UNKNOWN 128
+#define TRAVERSABLE_YES 255
+
+// Settings of the traversability stage, a limit of 0 is not checked
+struct TraversabilityOptions {
+    bool enabled = false;
+    int radius = 1;                // Half side of the roughness and step window (cells)
+    double max_slope = 20.0;       // degrees
+    double max_step = 100.0;       // mm
+    double max_roughness = 30.0;   // mm
+};
+
+// Traversability layers of a dense heightmap, all 0 on the empty cells
+struct TraversabilityMap {
+    cv::Mat slope;      // Slope of the surface (degrees, CV_32FC1)
+    cv::Mat roughness;  // Standard deviation of the heights in the window (mm, CV_32FC1)
+    cv::Mat step;       // Largest height difference with a cell of the window (mm, CV_32FC1)
+    cv::Mat navigable;  // TRAVERSABLE_YES, TRAVERSABLE_NO or TRAVERSABLE_UNKNOWN (CV_8UC1)
+    uint64_t n_navigable = 0;
+    uint64_t n_blocked = 0;
+};
+
+void compute_traversability(const cv::Mat& heights, const cv::Mat& valid, int cell_dim, const TraversabilityOptions& options,
+                            TraversabilityMap& map, int n_workers = 0);
+void compute_traversability(const TiledHeightmap& heightmap, const HeightmapLayout& layout, const TraversabilityOptions& options,
+                            TraversabilityMap& map, int n_workers = 0);
+bool write_traversability(const std::string& prefix, const TraversabilityMap& map);
+
+#endif // TRAVERSABILITY_H
@@ -45,10 +45,9 @@ Eigen::Matrix4d TranslationMatrix(double tx, double ty, double tz) {
 }
 
 int read_txt(const char i_filename[], const char o_filename[], Eigen::Matrix4d M, double& maxAbsX, double& maxAbsY){
-    ifstream myin;
+    TextReader reader;
     try {
-        myin.open(i_filename);
-        if (!myin) {
+        if (!reader.open(i_filename)) {
             throw std::ios_base::failure("Unable to open input file");
         }
     } catch (const std::ios_base::failure& e) {
@@ -57,23 +56,19 @@ int read_txt(const char i_filename[], const char o_filename[], Eigen::Matrix4d M
     }
     ofstream myout;
     myout.open(o_filename);
-    string line;
+    const char *line_begin, *line_end;
     int n_lines = 0;
-    while (getline(myin, line)) {
-        std::stringstream ss(line);  // Utilizziamo un stringstream per separare i valori
-        std::string temp;
-        // Crea un vettore Eigen a 3 dimensioni
-        Eigen::Vector4d vec;
-        vec(3)=1;
+    while (reader.next_line(line_begin, line_end)) {
         // Leggi i tre valori separati da virgola
-        getline(ss, temp, ',');
-        vec(0) = std::stod(temp);  // Assegna il primo valore al vettore (x)
-        getline(ss, temp, ',');
-        vec(1) = std::stod(temp);  // Assegna il secondo valore al vettore (y)
-        getline(ss, temp, ',');
-        vec(2) = std::stod(temp);  // Assegna il terzo valore al vettore (z)
+        double values[3];
+        if (parse_values(line_begin, line_end, values, 3) != 3) {
+            print_invalid_line(line_begin, line_end);
+            continue;
+        }
+        // Crea un vettore Eigen a 4 dimensioni
+        Eigen::Vector4d vec(values[0], values[1], values[2], 1);
         vec=M*vec;
-        myout << vec(0) << "," << vec(1) << "," << vec(2) << endl;
+        myout << vec(0) << "," << vec(1) << "," << vec(2) << "\n";
         if(std::abs(vec(0))>maxAbsX){
             maxAbsX = std::abs(vec(0));
         }
@@ -82,14 +77,13 @@ int read_txt(const char i_filename[], const char o_filename[], Eigen::Matrix4d M
         }
         n_lines++;
     }
-    myin.close();
     myout.close();
     return n_lines;
 }
 
 void populate_matrix_from_file(const char i_filename[], SparseMatrix<int>& matrix, int center_point_row, int center_point_col, int cell_dim, int n_lines) {
-    ifstream file(i_filename);
-    if (!file.is_open()) {
+    TextReader file;
+    if (!file.open(i_filename)) {
         cerr << "Error opening file!" << endl;
         return;
     }
@@ -98,15 +92,14 @@ void populate_matrix_from_file(const char i_filename[], SparseMatrix<int>& matri
     matrix.reserve(n_lines);
 
     int row, col;
-    string line;
-    while (getline(file, line)) {
-        istringstream iss(line);
-        double x, y, z;
-        char comma1, comma2;
-        if (!(iss >> x >> comma1 >> y >> comma2 >> z) || comma1 != ',' || comma2 != ',') {
-            cerr << "Invalid line format: " << line << endl;
+    const char *line_begin, *line_end;
+    while (file.next_line(line_begin, line_end)) {
+        double values[3];
+        if (parse_values(line_begin, line_end, values, 3) != 3) {
+            print_invalid_line(line_begin, line_end);
             continue;
         }
+        double x = values[0], y = values[1], z = values[2];
 
         col = center_point_col + static_cast<int>(floor(x / cell_dim));
         row = center_point_row - static_cast<int>(floor(y / cell_dim));
@@ -122,29 +115,27 @@ void populate_matrix_from_file(const char i_filename[], SparseMatrix<int>& matri
             cerr << "Coordinates (" << x << ", " << y << ") out of matrix bounds. (row: " << row << " col: " << col << ")" << endl;
         }
     }
-    file.close();
     matrix.makeCompressed();
     return;
 }
 
 void merge_matrix_with_file(const char i_filename[], MatrixXd& matrix, int center_point_row, int center_point_col, int cell_dim) {
-    ifstream file(i_filename);
-    if (!file.is_open()) {
+    TextReader file;
+    if (!file.open(i_filename)) {
         cerr << "Error opening file!" << endl;
         return;
     }
     int row, col;
     int n=0;
     int squared_sum=0;
-    string line;
-    while (getline(file, line)) {
-        istringstream iss(line);
-        double x, y, z;
-        char comma1, comma2;
-        if (!(iss >> x >> comma1 >> y >> comma2 >> z) || comma1 != ',' || comma2 != ',') {
-            cerr << "Invalid line format: " << line << endl;
+    const char *line_begin, *line_end;
+    while (file.next_line(line_begin, line_end)) {
+        double values[3];
+        if (parse_values(line_begin, line_end, values, 3) != 3) {
+            print_invalid_line(line_begin, line_end);
             continue;
         }
+        double x = values[0], y = values[1], z = values[2];
         col = center_point_col + static_cast<int>(floor(x / cell_dim));
         row = center_point_row - static_cast<int>(floor(y / cell_dim));
         
@@ -157,29 +148,27 @@ void merge_matrix_with_file(const char i_filename[], MatrixXd& matrix, int cente
             cerr << "Coordinates (" << x << ", " << y << ") out of matrix bounds. (row: "<< row <<" col: " <<col<<")" << endl;
         }
     }
-    file.close();
 }
 
 
 bool check_merge_matrix_with_file(const char i_filename[], SparseMatrix<int>& matrix, int center_point_row, int center_point_col, int cell_dim, int e) {
-    ifstream file(i_filename);
-    if (!file.is_open()) {
+    TextReader file;
+    if (!file.open(i_filename)) {
         cerr << "Error opening file!" << endl;
         return false;
     }
     int row, col;
     int n=0;
     int squared_sum=0;
-    string line;
-    while (getline(file, line)) {
-        istringstream iss(line);
-        double x, y, z;
+    const char *line_begin, *line_end;
+    while (file.next_line(line_begin, line_end)) {
+        double values[3];
         int temp_value;
-        char comma1, comma2;
-        if (!(iss >> x >> comma1 >> y >> comma2 >> z) || comma1 != ',' || comma2 != ',') {
-            cerr << "Invalid line format: " << line << endl;
+        if (parse_values(line_begin, line_end, values, 3) != 3) {
+            print_invalid_line(line_begin, line_end);
             continue;
         }
+        double x = values[0], y = values[1], z = values[2];
         col = center_point_col + static_cast<int>(floor(x / cell_dim));
         row = center_point_row - static_cast<int>(floor(y / cell_dim));
  
@@ -192,7 +181,6 @@ bool check_merge_matrix_with_file(const char i_filename[], SparseMatrix<int>& ma
             }   
         }
     }
-    file.close();
     printf("n: %d\n",n);
     printf("squared_sum: %d\n",squared_sum);
     if(squared_sum/n < e){
@@ -270,8 +258,8 @@ void saveSparseMatrixWithZerosToTxt(Eigen::SparseMatrix<int>& mat, const std::st
 
 
 void populate_matrix_from_file_better(const char i_filename[], cv::Mat& matrix, int center_point_row, int center_point_col, int cell_dim, int n_rows, int n_cols) { 
-    ifstream file(i_filename);
-    if (!file.is_open()) {
+    TextReader file;
+    if (!file.open(i_filename)) {
         cerr << "Error opening file!" << endl;
         return;
     }
@@ -279,15 +267,14 @@ void populate_matrix_from_file_better(const char i_filename[], cv::Mat& matrix,
     int z_value;
 
 
-    string line;
-    while (getline(file, line)) {
-        istringstream iss(line);
-        double x, y, z;
-        char comma1, comma2;
-        if (!(iss >> x >> comma1 >> y >> comma2 >> z) || comma1 != ',' || comma2 != ',') {
-            cerr << "Invalid line format: " << line << endl;
+    const char *line_begin, *line_end;
+    while (file.next_line(line_begin, line_end)) {
+        double values[3];
+        if (parse_values(line_begin, line_end, values, 3) != 3) {
+            print_invalid_line(line_begin, line_end);
             continue;
         }
+        double x = values[0], y = values[1], z = values[2];
         col = center_point_col + static_cast<int>(floor(x / cell_dim));
         row = center_point_row - static_cast<int>(floor(y / cell_dim));
 
@@ -301,7 +288,6 @@ void populate_matrix_from_file_better(const char i_filename[], cv::Mat& matrix,
             cerr << "Coordinates (" << x << ", " << y << ") out of matrix bounds. (row: " << row << " col: " << col << ")" << endl;
         }
     }
-    file.close();
     return;
 }
 
@@ -5,6 +5,7 @@
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 #include <opencv2/opencv.hpp>  // Include OpenCV header
+#include "../depth_image/text_reader.h"
 
 using namespace Eigen;
 using namespace std;